@@ -0,0 +1,28 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) Mathieu Carbou
+ */
+#include <Arduino.h>
+#include <MycilaDS18.h>
+
+Mycila::DS18 temp;
+
+void setup() {
+  Serial.begin(115200);
+  while (!Serial)
+    continue;
+
+  temp.begin(18);
+  temp.setConversionPolling(true);
+
+  // called from the OneWire32 engine task
+  temp.listen([](float temperature, bool changed) {
+    Serial.printf("Temperature: %.2f\n", temperature);
+  });
+}
+
+void loop() {
+  // returns immediately: the bus transactions are executed by the engine task
+  temp.readAsync();
+  delay(10);
+}
@@ -0,0 +1,73 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) Mathieu Carbou
+ */
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <MycilaDS18.h>
+
+// Measures what each operation costs on the wire and prints one JSON line per operation:
+// {"op":"search","devices":8,"transactions":...,"resets":...,"slots":...,"us":...}
+// Plug 1, 8, 32 or 64 sensors on the pin to compare bus sizes.
+
+#define PIN 18
+#define MAX_DEVICES 64
+
+OneWire32 oneWire(PIN);
+Mycila::DS18 temp;
+uint64_t addresses[MAX_DEVICES];
+uint8_t found = 0;
+
+template <typename F>
+static void measure(const char* op, F&& fn) {
+  OneWire32::Stats stats;
+  {
+    std::lock_guard<OneWire32> lock(oneWire);
+    oneWire.clearStats();
+    fn();
+    stats = oneWire.stats();
+  }
+  JsonDocument doc;
+  doc["op"] = op;
+  doc["devices"] = found;
+  doc["transactions"] = stats.transactions;
+  doc["resets"] = stats.resets;
+  doc["slots"] = stats.slots;
+  doc["us"] = stats.time;
+  serializeJson(doc, Serial);
+  Serial.println();
+}
+
+void setup() {
+  Serial.begin(115200);
+  while (!Serial)
+    continue;
+
+  measure("search", []() { found = oneWire.search(addresses, MAX_DEVICES); });
+
+  if (!found) {
+    Serial.println("No device found");
+    return;
+  }
+
+  temp.begin(&oneWire, addresses[0]);
+}
+
+void loop() {
+  if (!found)
+    return;
+
+  measure("request", []() { oneWire.request(); });
+  delay(MYCILA_DS18_CONVERSION_TIME_MS);
+
+  measure("getTemp", []() {
+    float t;
+    oneWire.getTemp(addresses[0], t);
+  });
+
+  // full cycle of a sensor: scratchpad read and next conversion request
+  delay(temp.getConversionTime());
+  measure("DS18::read", []() { temp.read(); });
+
+  delay(5000);
+}
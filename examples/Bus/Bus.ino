@@ -0,0 +1,57 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) Mathieu Carbou
+ */
+#include <Arduino.h>
+#include <MycilaDS18Bus.h>
+
+#define MAX_SENSORS 8
+
+Mycila::DS18Bus bus;
+Mycila::DS18 sensors[MAX_SENSORS];
+
+void setup() {
+  Serial.begin(115200);
+  while (!Serial)
+    continue;
+
+  bus.begin(18);
+  // read the sensors as soon as the conversion is complete
+  bus.setConversionPolling(true);
+
+  uint64_t addresses[MAX_SENSORS] = {0};
+  size_t found = 0;
+
+  Serial.println("Searching for DS18 sensors...");
+  for (int i = 0; i < 10 && found == 0; i++) {
+    found = bus.getOneWire()->search(addresses, MAX_SENSORS);
+    vTaskDelay(portTICK_PERIOD_MS);
+  }
+
+  for (size_t i = 0; i < found; i++) {
+    Serial.printf("Found device %u: %016llx\n", i + 1, addresses[i]);
+    sensors[i].begin(bus.getOneWire(), addresses[i]);
+    sensors[i].listen([i](float temperature, bool changed) {
+      Serial.printf("Temperature %u: %.2f\n", i + 1, temperature);
+    });
+    bus.add(sensors[i]);
+  }
+}
+
+uint32_t lastScan = 0;
+
+void loop() {
+  // detect sensors plugged or unplugged while running
+  if (millis() - lastScan > 60000) {
+    bus.scan([](uint64_t address, bool added) {
+      Serial.printf("Device %016llx %s\n", address, added ? "added" : "removed");
+    });
+    lastScan = millis();
+  }
+
+  // one broadcast conversion for all the sensors, then all the scratchpads are read back-to-back
+  if (bus.read() > 0) {
+    Serial.println("Bus cycle done");
+  }
+  delay(100);
+}
@@ -0,0 +1,32 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) Mathieu Carbou
+ */
+#include <Arduino.h>
+#include <MycilaDS18.h>
+#include <MycilaDS18Cache.h>
+
+Mycila::DS18NVSStorage storage;
+Mycila::DS18Cache cache(storage);
+Mycila::DS18 temp;
+
+void setup() {
+  Serial.begin(115200);
+  while (!Serial)
+    continue;
+
+  // the first boot searches the bus and stores the address: the next boots skip the search
+  const uint32_t start = millis();
+  cache.begin();
+  temp.begin(18, cache);
+  Serial.printf("Sensor 0x%llx ready in %" PRIu32 " ms\n", temp.getAddress(), millis() - start);
+
+  temp.listen([](float temperature, bool changed) {
+    Serial.printf("Temperature: %.2f\n", temperature);
+  });
+}
+
+void loop() {
+  temp.read();
+  delay(1000);
+}
@@ -0,0 +1,45 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) Mathieu Carbou
+ */
+#include <Arduino.h>
+#include <MycilaDS18Bus.h>
+
+#define MAX_SENSORS 4
+
+const int8_t pins[] = {18, 19};
+
+Mycila::DS18MultiBus multiBus;
+Mycila::DS18Bus buses[2];
+Mycila::DS18 sensors[2][MAX_SENSORS];
+
+void setup() {
+  Serial.begin(115200);
+  while (!Serial)
+    continue;
+
+  for (size_t b = 0; b < 2; b++) {
+    buses[b].begin(pins[b]);
+
+    uint64_t addresses[MAX_SENSORS] = {0};
+    size_t found = buses[b].getOneWire()->search(addresses, MAX_SENSORS);
+
+    for (size_t i = 0; i < found; i++) {
+      Serial.printf("Found device %u on pin %d: %016llx\n", i + 1, pins[b], addresses[i]);
+      sensors[b][i].begin(buses[b].getOneWire(), addresses[i]);
+      sensors[b][i].listen([b, i](float temperature, bool changed) {
+        Serial.printf("Bus %u - Temperature %u: %.2f\n", b + 1, i + 1, temperature);
+      });
+      buses[b].add(sensors[b][i]);
+    }
+
+    multiBus.add(buses[b]);
+  }
+}
+
+void loop() {
+  // all the buses are converted and read concurrently
+  size_t count = multiBus.read();
+  Serial.printf("Read %u sensors in %" PRIu32 " us\n", count, multiBus.getLastCycleTime());
+  delay(1000);
+}
@@ -0,0 +1,45 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) Mathieu Carbou
+ */
+#include <Arduino.h>
+#include <MycilaDS18Bus.h>
+
+// one RMT channel pair shared by 4 independent buses
+const int8_t pins[] = {16, 17, 18, 19};
+
+OneWire32 pool(pins[0]);
+Mycila::DS18Bus buses[4];
+Mycila::DS18 sensors[4];
+
+void setup() {
+  Serial.begin(115200);
+  while (!Serial)
+    continue;
+
+  for (size_t b = 0; b < 4; b++) {
+    buses[b].begin(&pool, pins[b]);
+
+    uint64_t address = 0;
+    {
+      std::lock_guard<OneWire32> lock(pool);
+      pool.route(pins[b]);
+      pool.search(&address, 1);
+    }
+    Serial.printf("Pin %d: %016llx (route time: %" PRIu32 " us)\n", pins[b], address, pool.routeTime());
+
+    if (address) {
+      sensors[b].begin(&pool, pins[b], address);
+      sensors[b].listen([b](float temperature, bool changed) {
+        Serial.printf("Pin %d: %.2f\n", pins[b], temperature);
+      });
+      buses[b].add(sensors[b]);
+    }
+  }
+}
+
+void loop() {
+  for (size_t b = 0; b < 4; b++)
+    buses[b].read();
+  delay(100);
+}
@@ -3,9 +3,19 @@
  * Copyright (C) 2023-2024 Mathieu Carbou
  */
 #include <MycilaDS18.h>
+#include <MycilaDS18Bus.h>
+#include <MycilaDS18Cache.h>
+#include <MycilaDS18Filter.h>
+#include <MycilaDS18History.h>
+
+#include <esp_timer.h>
+#include <string.h>
 
 #define TAG "DS18"
 
+// family codes of the supported sensors, searched in this order
+static const uint8_t DS18_FAMILIES[] = {MYCILA_DS18_DS18B20, MYCILA_DS18_DS1822, MYCILA_DS18_DS18S20, MYCILA_DS18_DS1825, MYCILA_DS18_DS28EA00};
+
 #ifndef GPIO_IS_VALID_OUTPUT_GPIO
   #define GPIO_IS_VALID_OUTPUT_GPIO(gpio_num) ((gpio_num >= 0) && \
                                                (((1ULL << (gpio_num)) & SOC_GPIO_VALID_OUTPUT_GPIO_MASK) != 0))
@@ -25,21 +35,60 @@ void Mycila::DS18::begin(const int8_t pin, uint8_t maxSearchCount) {
 
   _oneWire = new OneWire32(_pin);
 
-  ESP_LOGI(TAG, "Searching for DS18 sensor on pin: %" PRId8 "...", pin);
-  while (maxSearchCount-- > 0 && !_oneWire->search(&_deviceAddress, 1)) {
-    vTaskDelay(portTICK_PERIOD_MS);
+  if (!_search(maxSearchCount)) {
+    delete _oneWire;
+    _oneWire = nullptr;
+    return;
   }
 
-  if (!_deviceAddress) {
-    ESP_LOGE(TAG, "No DS18 sensor found on pin: %" PRId8, pin);
+  _readConfiguration();
+  _request();
+
+  ESP_LOGI(TAG, "%s 0x%llx @ pin %d enabled!", _name, _deviceAddress, _pin);
+  _enabled = true;
+}
+
+void Mycila::DS18::begin(const int8_t pin, DS18Cache& cache, uint8_t maxSearchCount) {
+  if (_enabled)
+    return;
+
+  if (GPIO_IS_VALID_OUTPUT_GPIO(pin)) {
+    _pin = (gpio_num_t)pin;
+  } else {
+    ESP_LOGE(TAG, "Disable DS18 Sensor: Invalid pin: %" PRId8, pin);
+    _pin = GPIO_NUM_NC;
     return;
   }
 
-  _name = getModel();
+  _oneWire = new OneWire32(_pin);
 
-  ESP_LOGI(TAG, "Found %s sensor at address 0x%llx on pin: %" PRId8 " (remaining search count: %d)", _name, _deviceAddress, _pin, maxSearchCount);
+  // a cached sensor answering an addressed scratchpad read is used without searching the bus
+  _deviceAddress = cache.find(pin);
+  if (_deviceAddress) {
+    _name = getModel();
+    if (_readConfiguration()) {
+      ESP_LOGI(TAG, "Found cached %s sensor at address 0x%llx on pin: %" PRId8, _name, _deviceAddress, _pin);
+    } else {
+      ESP_LOGW(TAG, "Cached %s sensor at address 0x%llx on pin %" PRId8 " is not responding", _name, _deviceAddress, _pin);
+      cache.remove(pin, _deviceAddress);
+      _deviceAddress = 0;
+    }
+  }
 
-  _oneWire->request(_deviceAddress);
+  if (!_deviceAddress) {
+    if (!_search(maxSearchCount)) {
+      cache.commit();
+      delete _oneWire;
+      _oneWire = nullptr;
+      return;
+    }
+    _readConfiguration();
+  }
+
+  cache.put(pin, _deviceAddress);
+  cache.commit();
+
+  _request();
 
   ESP_LOGI(TAG, "%s 0x%llx @ pin %d enabled!", _name, _deviceAddress, _pin);
   _enabled = true;
@@ -66,13 +115,21 @@ void Mycila::DS18::begin(const int8_t pin, uint64_t address) {
 
   _oneWire = new OneWire32(_pin);
   _name = getModel();
-  _oneWire->request(_deviceAddress);
+  _readConfiguration();
+  _request();
 
   ESP_LOGI(TAG, "%s 0x%llx @ pin %d enabled!", _name, _deviceAddress, _pin);
   _enabled = true;
 }
 
 void Mycila::DS18::begin(OneWire32* oneWire, uint64_t address) {
+  begin(oneWire, oneWire->pin(), address);
+}
+
+void Mycila::DS18::begin(OneWire32* oneWire, const int8_t pin, uint64_t address) {
+  if (_enabled)
+    return;
+
   _deviceAddress = address;
 
   if (!_deviceAddress) {
@@ -81,17 +138,27 @@ void Mycila::DS18::begin(OneWire32* oneWire, uint64_t address) {
   }
 
   _oneWire = oneWire;
-  _pin = oneWire->pin();
+  _pin = (gpio_num_t)pin;
   _ownOneWire = false;
   _name = getModel();
-  _oneWire->request(_deviceAddress);
+  _readConfiguration();
+  _request();
 
   ESP_LOGI(TAG, "%s 0x%llx @ pin %d enabled!", _name, _deviceAddress, _pin);
   _enabled = true;
 }
 
 void Mycila::DS18::end() {
+  stopTask();
+
+  if (_bus)
+    _bus->remove(*this);
+
   if (_enabled) {
+    // let pending async transactions complete: their callbacks lock the sensor
+    _oneWire->wait(_readTx);
+    _oneWire->wait(_convertTx);
+
     std::lock_guard<std::mutex> lock(_mutex);
     _enabled = false;
     if (_ownOneWire && _oneWire) {
@@ -100,8 +167,7 @@ void Mycila::DS18::end() {
       // Give some time for RMT channels to be properly released
       vTaskDelay(pdMS_TO_TICKS(10));
     }
-    _temperature = 0;
-    _lastTime = 0;
+    _publish(0, 0, OneWire32::Result::OK);
     _pin = GPIO_NUM_NC;
     _deviceAddress = 0;
     ESP_LOGI(TAG, "%s 0x%llx @ pin %d disabled!", _name, _deviceAddress, _pin);
@@ -114,62 +180,483 @@ bool Mycila::DS18::read() {
   if (!_enabled)
     return false;
 
-  float read;
-  OneWire32::Result result = _oneWire->getTemp(_deviceAddress, read);
+  // keep the scratchpad read and the next conversion request together on a shared bus
+  std::lock_guard<OneWire32> busLock(*_oneWire);
+
+  if (_maxInterval && !_due())
+    return false;
+
+  if (_conversionPolling && !_bus && !_converted())
+    return false;
+
+  _cycleStart = esp_timer_get_time();
 
-  // request new reading
+  if (!_oneWire->route(_pin))
+    return _process(OneWire32::Result::DRIVER, 0);
+
+  int16_t read = 0;
+  OneWire32::Result result = _getTemp(read);
+
+  // request new reading, unless a bus is broadcasting conversions for us
+  // or unless it will be requested just in time for the next due read
+  if (_maxInterval)
+    _requested = false;
+  else if (!_bus)
+    _request();
+
+  return _process(result, read);
+}
+
+bool Mycila::DS18::readAsync() {
+  std::lock_guard<std::mutex> lock(_mutex);
+
+  if (!_enabled || _readTx.pending() || _convertTx.pending())
+    return false;
+
+  // the conversion is chained to the read: the next due reading is one interval old
+  if (!isDue())
+    return false;
+
+  // polling the bus would block: only rely on the conversion time
+  if (_conversionPolling && !_bus && millis() - _requestTime < getConversionTime())
+    return false;
+
+  _readFrame[0] = 0x55; // MATCH ROM
+  memcpy(_readFrame + 1, &_deviceAddress, 8);
+  _readFrame[9] = 0xBE; // Read Scratchpad
+  _readTx.clear().route(_pin).reset().write(_readFrame, sizeof(_readFrame)).read(_scratchpad, sizeof(_scratchpad));
+  _readTx.onComplete(_onReadComplete, this);
+  _cycleStart = esp_timer_get_time();
+  if (!_oneWire->submit(_readTx)) {
+    _cycleStart = 0;
+    return false;
+  }
+
+  // request new reading, unless a bus is broadcasting conversions for us
+  if (!_bus) {
+    memcpy(_convertFrame, _readFrame, sizeof(_convertFrame));
+    _convertFrame[9] = 0x44; // Convert T
+    _convertTx.clear().route(_pin).reset().write(_convertFrame, sizeof(_convertFrame), true);
+    _convertTx.onComplete(_onConvertComplete, this);
+    _oneWire->submit(_convertTx);
+  }
+
+  return true;
+}
+
+void Mycila::DS18::_onReadComplete(OneWire32::Transaction& tx, void* arg) {
+  DS18* ds18 = static_cast<DS18*>(arg);
+  std::lock_guard<std::mutex> lock(ds18->_mutex);
+  ds18->_readAsyncOk = false;
+  if (!ds18->_enabled)
+    return;
+  OneWire32::Result result = tx.result();
+  if (result == OneWire32::Result::OK)
+    result = OneWire32::checkScratchpad(ds18->_scratchpad);
+  const int16_t read = result == OneWire32::Result::OK ? ds18->_decoder(ds18->_scratchpad) : 0;
+  ds18->_readAsyncOk = ds18->_process(result, read);
+}
+
+void Mycila::DS18::_onConvertComplete(OneWire32::Transaction& tx, void* arg) {
+  DS18* ds18 = static_cast<DS18*>(arg);
+  std::lock_guard<std::mutex> lock(ds18->_mutex);
+  if (tx.result() == OneWire32::Result::OK)
+    ds18->_requestTime = millis();
+}
+
+void Mycila::DS18::_request() {
+  std::lock_guard<OneWire32> busLock(*_oneWire);
+  if (!_oneWire->route(_pin))
+    return;
   _oneWire->request(_deviceAddress);
+  _requestTime = millis();
+  _requested = true;
+}
+
+bool Mycila::DS18::_converted() {
+  bool done;
+  if (_oneWire->pin() == _pin && _oneWire->poll(done))
+    return done;
+  // bus was used in between: fallback to the conversion time
+  return millis() - _requestTime >= getConversionTime();
+}
+
+void Mycila::DS18::setAdaptivePolling(uint32_t minInterval, uint32_t maxInterval) {
+  std::lock_guard<std::mutex> lock(_mutex);
+  // without adaptive polling, a conversion was requested by begin() or by the last read
+  if (!_maxInterval)
+    _requested = true;
+  // the interval must be able to grow
+  _minInterval = minInterval ? minInterval : 1;
+  _maxInterval = maxInterval && maxInterval < _minInterval ? _minInterval : maxInterval;
+  _interval = _minInterval;
+  _pollPrimed = false;
+}
+
+bool Mycila::DS18::_due() {
+  const uint32_t elapsed = millis() - _lastPoll;
+  if (_bus)
+    return elapsed >= _interval;
+  // start the conversion so that it completes when the sensor is due
+  if (!_requested) {
+    if (elapsed + getConversionTime() >= _interval)
+      _request();
+    return false;
+  }
+  return elapsed >= _interval && _converted();
+}
+
+void Mycila::DS18::_adapt(bool ok, int16_t raw) {
+  _lastPoll = millis();
+
+  if (!ok) {
+    // retry quickly
+    _interval = _minInterval;
+    return;
+  }
+
+  if (_pollPrimed) {
+    // integer math only: compare the change since the previous reading with the threshold
+    const int16_t delta = raw > _pollRaw ? raw - _pollRaw : _pollRaw - raw;
+    if (delta > _rawThreshold)
+      _interval = _minInterval;
+    else if (delta * 2 <= _rawThreshold)
+      _interval = _interval > _maxInterval / 2 ? _maxInterval : _interval * 2;
+    if (_interval < _minInterval)
+      _interval = _minInterval;
+  }
+  _pollRaw = raw;
+  _pollPrimed = true;
+
+  // leave room for a retry before the temperature expires
+  if (_expirationDelay && _interval > _expirationDelay * 500)
+    _interval = _expirationDelay * 500 > _minInterval ? _expirationDelay * 500 : _minInterval;
+}
+
+bool Mycila::DS18::_search(uint8_t maxSearchCount) {
+  ESP_LOGI(TAG, "Searching for DS18 sensor on pin: %" PRId8 "...", _pin);
+  // targeted search: other devices on the bus (iButtons, DS2438, ...) are skipped
+  while (maxSearchCount-- > 0) {
+    for (size_t i = 0; i < sizeof(DS18_FAMILIES) && !_deviceAddress; i++)
+      _oneWire->search(&_deviceAddress, 1, DS18_FAMILIES[i]);
+    if (_deviceAddress)
+      break;
+    vTaskDelay(portTICK_PERIOD_MS);
+  }
+
+  if (!_deviceAddress) {
+    ESP_LOGE(TAG, "No DS18 sensor found on pin: %" PRId8, _pin);
+    return false;
+  }
+
+  _name = getModel();
+
+  ESP_LOGI(TAG, "Found %s sensor at address 0x%llx on pin: %" PRId8 " (remaining search count: %d)", _name, _deviceAddress, _pin, maxSearchCount);
+  return true;
+}
+
+bool Mycila::DS18::_readConfiguration() {
+  // decoding depends on the family: chosen once for all the reads
+  _decoder = OneWire32::decoder(_deviceAddress);
+
+  uint8_t data[9];
+  std::lock_guard<OneWire32> busLock(*_oneWire);
+  const bool ok = _oneWire->route(_pin) && _oneWire->readScratchpad(_deviceAddress, data) == OneWire32::Result::OK;
+  if (ok) {
+    _alarmHigh = static_cast<int8_t>(data[2]);
+    _alarmLow = static_cast<int8_t>(data[3]);
+    if ((_deviceAddress & 0xFF) != MYCILA_DS18_DS18S20)
+      _resolution = MYCILA_DS18_MIN_RESOLUTION + ((data[4] >> 5) & 0x03);
+  }
+  if ((_deviceAddress & 0xFF) == MYCILA_DS18_DS18S20)
+    _resolution = MYCILA_DS18_MIN_RESOLUTION;
+  if (ok && _oneWire->readPowerSupply(_deviceAddress, _parasite) && _parasite) {
+    ESP_LOGI(TAG, "%s 0x%llx @ pin %d: parasite-powered", _name, _deviceAddress, _pin);
+    if (!_oneWire->setParasite(true))
+      ESP_LOGW(TAG, "%s 0x%llx @ pin %d: Too many pins to enable parasite mode", _name, _deviceAddress, _pin);
+  }
+  return ok;
+}
+
+bool Mycila::DS18::_writeConfiguration(int8_t low, int8_t high, uint8_t bits, bool persist) {
+  std::lock_guard<OneWire32> busLock(*_oneWire);
+  if (!_oneWire->route(_pin))
+    return false;
+
+  // DS18S20 has no configuration register
+  const uint8_t config[3] = {static_cast<uint8_t>(high), static_cast<uint8_t>(low), static_cast<uint8_t>(((bits - MYCILA_DS18_MIN_RESOLUTION) << 5) | 0x1F)};
+  if (!_oneWire->writeScratchpad(_deviceAddress, config, (_deviceAddress & 0xFF) == MYCILA_DS18_DS18S20 ? 2 : 3))
+    return false;
+
+  if (persist && !_oneWire->copyScratchpad(_deviceAddress))
+    return false;
+
+  _alarmLow = low;
+  _alarmHigh = high;
+  _resolution = bits;
+
+  // restart the conversion with the new configuration
+  if (!_bus)
+    _request();
+
+  return true;
+}
+
+uint32_t Mycila::DS18::getConversionTime(uint64_t address, uint8_t resolution) {
+  // DS18S20 has a fixed 9-bit resolution but still needs the full conversion time
+  if ((address & 0xFF) == MYCILA_DS18_DS18S20 || resolution < MYCILA_DS18_MIN_RESOLUTION || resolution > MYCILA_DS18_MAX_RESOLUTION)
+    return MYCILA_DS18_CONVERSION_TIME_MS;
+  static constexpr uint16_t times[] = {94, 188, 375, MYCILA_DS18_CONVERSION_TIME_MS};
+  return times[resolution - MYCILA_DS18_MIN_RESOLUTION];
+}
+
+bool Mycila::DS18::setResolution(uint8_t bits, bool persist) {
+  if (bits < MYCILA_DS18_MIN_RESOLUTION || bits > MYCILA_DS18_MAX_RESOLUTION)
+    return false;
+
+  std::lock_guard<std::mutex> lock(_mutex);
+
+  if (!_enabled || (_deviceAddress & 0xFF) == MYCILA_DS18_DS18S20)
+    return false;
+
+  if (!_writeConfiguration(_alarmLow, _alarmHigh, bits, persist))
+    return false;
+
+  ESP_LOGI(TAG, "%s 0x%llx @ pin %d: resolution set to %" PRIu8 " bits", _name, _deviceAddress, _pin, bits);
+  return true;
+}
+
+bool Mycila::DS18::setAlarm(int8_t low, int8_t high, bool persist) {
+  if (low > high)
+    return false;
+
+  std::lock_guard<std::mutex> lock(_mutex);
+
+  if (!_enabled)
+    return false;
+
+  if (!_writeConfiguration(low, high, _resolution, persist))
+    return false;
+
+  ESP_LOGI(TAG, "%s 0x%llx @ pin %d: alarm set to [%" PRId8 ", %" PRId8 "] °C", _name, _deviceAddress, _pin, low, high);
+  return true;
+}
+
+OneWire32::Result Mycila::DS18::_getTemp(int16_t& raw) {
+  OneWire32::Result result = OneWire32::Result::BAD_DATA;
+  if (_fastRead && ++_fastReadCount < _fastRead)
+    result = _oneWire->getTempFast(_deviceAddress, raw, _resolution);
+  // full read, or implausible value to confirm with a full read
+  if (result == OneWire32::Result::BAD_DATA) {
+    _fastReadCount = 0;
+    uint8_t data[9];
+    result = _oneWire->readScratchpad(_deviceAddress, data);
+    if (result == OneWire32::Result::OK)
+      raw = _decoder(data);
+  }
+  return result;
+}
+
+bool Mycila::DS18::_process(OneWire32::Result result, int16_t read) {
+  const Snapshot last = getSnapshot();
+
+  if (_cycleStart) {
+    _health.latency.add(esp_timer_get_time() - _cycleStart);
+    _cycleStart = 0;
+  }
 
   // process data when no error
   if (result != OneWire32::Result::OK) {
+    _publish(last.raw, last.time, result);
+    _health.failures++;
+    if (_maxInterval)
+      _adapt(false, 0);
     switch (result) {
       case OneWire32::Result::OK:
         break;
       case OneWire32::Result::CRC:
+        _health.crc++;
         ESP_LOGW(TAG, "%s 0x%llx @ pin %d: CRC error", _name, _deviceAddress, _pin);
         return false;
       case OneWire32::Result::BAD_DATA:
+        _health.badData++;
         ESP_LOGW(TAG, "%s 0x%llx @ pin %d: Bad data", _name, _deviceAddress, _pin);
         return false;
       case OneWire32::Result::TIMEOUT:
+        _health.timeout++;
         ESP_LOGW(TAG, "%s 0x%llx @ pin %d: Timeout", _name, _deviceAddress, _pin);
         return false;
       case OneWire32::Result::DRIVER:
+        _health.driver++;
         ESP_LOGW(TAG, "%s 0x%llx @ pin %d: Driver not initialized", _name, _deviceAddress, _pin);
         return false;
     }
     return false;
   }
 
-  // discard any invalid read
-  if (std::isnan(read))
+  _health.ok++;
+  _health.failures = 0;
+
+  // the filter chain runs before the change detection
+  if (_filter && !_filter->apply(read, millis())) {
+    _health.filtered++;
+    _publish(last.raw, last.time, result);
+    if (_maxInterval)
+      _adapt(false, 0);
+    ESP_LOGD(TAG, "%s 0x%llx @ pin %d: Filtered out %f °C", _name, _deviceAddress, _pin, read / 16.0f);
     return false;
+  }
+
+  if (_maxInterval)
+    _adapt(true, read);
+
+  // integer math only
+  const int16_t delta = read > last.raw ? read - last.raw : last.raw - read;
+  const bool changed = delta > _rawThreshold || !_valid(last);
+  const int16_t raw = changed ? read : last.raw;
 
   // read is valid, record the time
-  _lastTime = millis();
+  const uint32_t now = millis();
+  _publish(raw, now, result);
 
-  const bool changed = std::abs(read - _temperature) > _threshold || !isValid();
+  if (_history)
+    _history->add(read, now);
 
   if (changed) {
-    _temperature = read;
-    ESP_LOGD(TAG, "%s 0x%llx @ pin %d: %f °C", _name, _deviceAddress, _pin, read);
+    ESP_LOGD(TAG, "%s 0x%llx @ pin %d: %f °C", _name, _deviceAddress, _pin, read / 16.0f);
   }
 
+  if (_rawCallback)
+    _rawCallback(raw, changed);
+
   if (_callback)
-    _callback(_temperature, changed);
+    _callback(raw / 16.0f, changed);
 
   return true;
 }
 
+void Mycila::DS18::_publish(int16_t raw, uint32_t time, OneWire32::Result result) {
+  const uint32_t seq = _seq.load(std::memory_order_relaxed);
+  _seq.store(seq + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  _raw.store(raw, std::memory_order_relaxed);
+  _lastTime.store(time, std::memory_order_relaxed);
+  _lastResult.store(result, std::memory_order_relaxed);
+  _seq.store(seq + 2, std::memory_order_release);
+}
+
+Mycila::DS18::Snapshot Mycila::DS18::getSnapshot() const {
+  Snapshot snapshot;
+  uint32_t seq;
+  do {
+    // wait for the writer to finish: it may have been preempted by this task, so let it run
+    while ((seq = _seq.load(std::memory_order_acquire)) & 1)
+      vTaskDelay(1);
+    snapshot.raw = _raw.load(std::memory_order_relaxed);
+    snapshot.time = _lastTime.load(std::memory_order_relaxed);
+    snapshot.result = static_cast<OneWire32::Result>(_lastResult.load(std::memory_order_relaxed));
+    std::atomic_thread_fence(std::memory_order_acquire);
+  } while (seq != _seq.load(std::memory_order_relaxed));
+  snapshot.temperature = snapshot.raw / 16.0f;
+  return snapshot;
+}
+
+bool Mycila::DS18::startTask(uint32_t period, BaseType_t core, UBaseType_t priority) {
+  if (_task)
+    return true;
+
+  if (!_enabled || !period)
+    return false;
+
+  _taskPeriod = period;
+  _taskStop = false;
+  if (xTaskCreatePinnedToCore(_taskLoop, "ds18", 4096, this, priority, &_task, core) != pdPASS) {
+    ESP_LOGE(TAG, "%s 0x%llx @ pin %d: Failed to start task", _name, _deviceAddress, _pin);
+    _task = nullptr;
+    return false;
+  }
+
+  ESP_LOGI(TAG, "%s 0x%llx @ pin %d: Task started (period: %" PRIu32 " ms)", _name, _deviceAddress, _pin, period);
+  return true;
+}
+
+void Mycila::DS18::stopTask() {
+  if (!_task)
+    return;
+  // dedicated semaphore: task notifications of the calling task may be used by someone else
+  StaticSemaphore_t stopped;
+  _taskStopper = xSemaphoreCreateBinaryStatic(&stopped);
+  _taskStop = true;
+  // wake up the task if it is waiting for its next period
+  xTaskNotifyGive(_task);
+  xSemaphoreTake(_taskStopper, portMAX_DELAY);
+  _taskStopper = nullptr;
+  _task = nullptr;
+}
+
+void Mycila::DS18::_taskLoop(void* arg) {
+  DS18* ds18 = static_cast<DS18*>(arg);
+  const TickType_t period = pdMS_TO_TICKS(ds18->_taskPeriod);
+  TickType_t lastWake = xTaskGetTickCount();
+  while (!ds18->_taskStop) {
+    ds18->read();
+    // keep a fixed cadence, but let stopTask() interrupt the wait
+    const TickType_t elapsed = xTaskGetTickCount() - lastWake;
+    if (elapsed < period)
+      ulTaskNotifyTake(pdTRUE, period - elapsed);
+    lastWake += period;
+    if (xTaskGetTickCount() - lastWake > period)
+      lastWake = xTaskGetTickCount();
+  }
+  xSemaphoreGive(ds18->_taskStopper);
+  vTaskDelete(NULL);
+}
+
+Mycila::DS18::Health Mycila::DS18::getHealth() const {
+  std::lock_guard<std::mutex> lock(_mutex);
+  return _health;
+}
+
+void Mycila::DS18::clearHealth() {
+  std::lock_guard<std::mutex> lock(_mutex);
+  _health = {};
+}
+
 #ifdef MYCILA_JSON_SUPPORT
+static void histogramToJson(const JsonArray& root, const OneWire32::Histogram& histogram) {
+  for (uint8_t i = 0; i < OneWire32::Histogram::size; i++)
+    root.add(histogram.counts[i]);
+}
+
 void Mycila::DS18::toJson(const JsonObject& root) const {
+  const Snapshot snapshot = getSnapshot();
+  const bool valid = _valid(snapshot);
   root["enabled"] = _enabled;
   root["model"] = getModel();
   root["address"] = _deviceAddress;
-  root["elapsed"] = getElapsedTime();
-  root["expired"] = isExpired();
-  root["temp"] = getTemperature().value_or(0);
-  root["time"] = _lastTime;
-  root["valid"] = isValid();
+  root["elapsed"] = _elapsed(snapshot);
+  root["expired"] = _expired(snapshot);
+  root["temp"] = valid ? snapshot.temperature : 0;
+  root["time"] = snapshot.time;
+  root["valid"] = valid;
+
+  const Health counters = getHealth();
+  const JsonObject health = root["health"].to<JsonObject>();
+  health["ok"] = counters.ok;
+  health["crc"] = counters.crc;
+  health["bad_data"] = counters.badData;
+  health["timeout"] = counters.timeout;
+  health["driver"] = counters.driver;
+  health["filtered"] = counters.filtered;
+  health["failures"] = counters.failures;
+  histogramToJson(health["latency"].to<JsonArray>(), counters.latency);
+
+  if (_oneWire) {
+    const OneWire32::Health& bus = _oneWire->health();
+    const JsonObject onewire = root["onewire"].to<JsonObject>();
+    onewire["resets"] = bus.resets;
+    onewire["absent"] = bus.absent;
+    histogramToJson(onewire["latency"].to<JsonArray>(), bus.latency);
+  }
 }
 #endif
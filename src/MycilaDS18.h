@@ -14,6 +14,8 @@
 
 #include <esp32-hal.h>
 
+#include <atomic>
+#include <functional>
 #include <mutex>
 #include <optional>
 #include <utility>
@@ -33,6 +35,12 @@
   #define MYCILA_DS18_RELEVANT_TEMPERATURE_CHANGE 0.3f
 #endif
 
+// Conversion time of a DS18 sensor at 12-bit resolution
+#define MYCILA_DS18_CONVERSION_TIME_MS 750
+
+#define MYCILA_DS18_MIN_RESOLUTION 9
+#define MYCILA_DS18_MAX_RESOLUTION 12
+
 #define MYCILA_DS18_DS18S20  0x10
 #define MYCILA_DS18_DS1822   0x22
 #define MYCILA_DS18_DS18B20  0x28
@@ -40,21 +48,102 @@
 #define MYCILA_DS18_DS28EA00 0x42
 
 namespace Mycila {
+  class DS18Bus;
+  class DS18Cache;
+  class DS18Filter;
+  class DS18HistoryBase;
+  class DS18MultiBus;
+
   // callback signature for temperature reads.
   // "changed" will be true if the temperature has changed by more than "MYCILA_DS18_RELEVANT_TEMPERATURE_CHANGE" degrees
   typedef std::function<void(float temperature, bool changed)> DS18ChangeCallback;
+  // same as DS18ChangeCallback, with the temperature in 1/16 °C
+  typedef std::function<void(int16_t raw, bool changed)> DS18RawChangeCallback;
   class DS18 {
     public:
+      // Consistent view of the last reading
+      typedef struct {
+          // last relevant temperature (see setThreshold())
+          float temperature;
+          // same in 1/16 °C
+          int16_t raw;
+          // time of the last valid reading, 0 if none
+          uint32_t time;
+          // result of the last read attempt
+          OneWire32::Result result;
+      } Snapshot;
+
+      // Always-on read counters
+      typedef struct {
+          // reads by result
+          uint32_t ok;
+          uint32_t crc;
+          uint32_t badData;
+          uint32_t timeout;
+          uint32_t driver;
+          // successful reads rejected by the filter chain
+          uint32_t filtered;
+          // consecutive failed reads since the last successful one
+          uint32_t failures;
+          // duration of the read cycles (scratchpad read and next conversion request) in microseconds
+          OneWire32::Histogram latency;
+      } Health;
+
       ~DS18() { end(); }
 
       void setExpirationDelay(uint32_t seconds) { _expirationDelay = seconds; }
       uint32_t getExpirationDelay() const { return _expirationDelay; }
 
       void listen(DS18ChangeCallback callback) { _callback = std::move(callback); }
+      // Same as listen() but without any floating point: the temperature is in 1/16 °C
+      void listenRaw(DS18RawChangeCallback callback) { _rawCallback = std::move(callback); }
+
+      /**
+       * @brief Poll the sensor for the end of the conversion before reading the scratchpad
+       * When enabled, read() returns false until the sensor reports that the conversion is complete (read slot at 1).
+       * If the bus was used by another device in between, the conversion time is waited instead.
+       * This avoids stale reads and lets the application call read() as often as it wants.
+       * @param enable true to enable conversion polling, default is false
+       */
+      void setConversionPolling(bool enable) { _conversionPolling = enable; }
+      bool isConversionPolling() const { return _conversionPolling; }
+
+      /**
+       * @brief Adapt the interval between two reads of the sensor to its rate of change
+       * read() can then be called as often as needed: it returns false until the sensor is due.
+       * After each reading, the interval is reset to minInterval if the temperature changed by more than the threshold (see setThreshold()),
+       * kept if it changed by more than half the threshold and doubled otherwise, up to maxInterval.
+       * Failed and filtered out readings also reset the interval to minInterval.
+       * The interval never exceeds half the expiration delay, so that a reading can be retried before the temperature expires.
+       * Without a bus, the conversion is started just in time for the next read so that the reading is fresh.
+       * @param minInterval The minimum interval in milliseconds
+       * @param maxInterval The maximum interval in milliseconds, 0 to disable (default)
+       */
+      void setAdaptivePolling(uint32_t minInterval, uint32_t maxInterval);
+      // Current interval between two reads in milliseconds, 0 if the adaptive polling is disabled
+      uint32_t getPollingInterval() const { return _maxInterval ? _interval : 0; }
+      // Check if the sensor is due for a read: always true if the adaptive polling is disabled
+      bool isDue() const { return !_maxInterval || millis() - _lastPoll >= _interval; }
+
+      /**
+       * @brief Read only the 2 temperature bytes of the scratchpad instead of the 9 bytes
+       * The read is aborted with a reset after the temperature bytes, so there is no CRC check:
+       * only the all-ones and 85 °C power-on values are rejected, in which case a full read is done instead.
+       * A full CRC-checked read is still done every fullReadInterval reads to detect a degraded bus.
+       * DS18S20 sensors read 8 bytes instead, so that fast and full reads have the same extended resolution.
+       * Only used by read() and DS18Bus::read(): readAsync() always reads the full scratchpad.
+       * @param fullReadInterval Number of reads between 2 full reads, 0 to disable the fast read (default)
+       */
+      void setFastRead(uint8_t fullReadInterval) { _fastRead = fullReadInterval; }
+      uint8_t getFastRead() const { return _fastRead; }
 
       void begin(const int8_t pin, uint8_t maxSearchCount = 10);
+      // Use the address cached for the pin if the sensor answers, otherwise search the bus and update the cache
+      void begin(const int8_t pin, DS18Cache& cache, uint8_t maxSearchCount = 10);
       void begin(const int8_t pin, uint64_t address);
       void begin(OneWire32* oneWire, uint64_t address);
+      // Use an existing OneWire32 instance shared between several pins: the RMT channels are routed to the pin before each access
+      void begin(OneWire32* oneWire, const int8_t pin, uint64_t address);
       void end();
 
       const char* getModel() const {
@@ -82,56 +171,226 @@ namespace Mycila {
       // This method can be called in the loop
       bool read();
 
+      // Read the temperature from the sensor without blocking the calling task
+      // The scratchpad read (and the next conversion request) are queued to the OneWire32 engine task.
+      // Returns true if the read was queued, false if a read is still pending or the conversion is not complete.
+      // The result is processed like read() but from the engine task: the callback is called from there.
+      bool readAsync();
+
       gpio_num_t getPin() const { return _pin; };
+      // true if the sensor is parasite-powered (2 wires): the OneWire32 instance is then switched to parasite mode
+      bool isParasite() const { return _parasite; }
       uint64_t getAddress() const { return _deviceAddress; };
       bool isEnabled() const { return _enabled; }
 
+      /**
+       * @brief Start a FreeRTOS task calling read() periodically
+       * Readers in other tasks never block on the bus: they get the last published snapshot.
+       * @param period The period in milliseconds between two reads
+       * @param core The core to pin the task to, default is no affinity
+       * @param priority The task priority
+       * @return true if the task is running
+       */
+      bool startTask(uint32_t period, BaseType_t core = tskNO_AFFINITY, UBaseType_t priority = 1);
+      void stopTask();
+      bool isTaskRunning() const { return _task != nullptr; }
+
+      // Get a consistent snapshot of the last reading, without blocking on the bus (seqlock):
+      // a reader which preempted the writer in the middle of a publish sleeps one tick to let it finish
+      Snapshot getSnapshot() const;
+
       // Get the last time when the temperature was read
-      uint32_t getLastTime() const { return _lastTime; }
+      uint32_t getLastTime() const { return getSnapshot().time; }
 
       // Get the elapsed time since the last reading
-      uint32_t getElapsedTime() const { return _enabled ? millis() - _lastTime : 0; }
+      uint32_t getElapsedTime() const { return _elapsed(getSnapshot()); }
 
       // Check if the last reading has expired
-      bool isExpired() const { return _expirationDelay > 0 && (getElapsedTime() >= _expirationDelay * 1000); }
+      bool isExpired() const { return _expired(getSnapshot()); }
 
       // Check if the last reading is valid and present
-      bool isValid() const { return _enabled && _lastTime > 0 && !isExpired(); }
+      bool isValid() const { return _valid(getSnapshot()); }
 
       // Get the temperature in Celsius
       std::optional<float> getTemperature() const {
-        if (isValid()) {
-          return _temperature;
+        const Snapshot snapshot = getSnapshot();
+        if (_valid(snapshot)) {
+          return snapshot.temperature;
+        }
+        return std::nullopt;
+      }
+
+      // Get the temperature in 1/16 °C
+      std::optional<int16_t> getRawTemperature() const {
+        const Snapshot snapshot = getSnapshot();
+        if (_valid(snapshot)) {
+          return snapshot.raw;
         }
         return std::nullopt;
       }
 
       OneWire32* getOneWire() const { return _oneWire; }
 
+      // Record each successful reading in a history (see DS18History), nullptr to detach.
+      // The history must outlive the sensor or be detached first.
+      void setHistory(DS18HistoryBase* history) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _history = history;
+      }
+      DS18HistoryBase* getHistory() const { return _history; }
+
+      // Filter the successful readings (see DS18Filter) before the change detection, nullptr to detach.
+      // Rejected readings are counted in getHealth() and do not update the temperature nor call the callbacks.
+      // The filter must outlive the sensor or be detached first.
+      void setFilter(DS18Filter* filter) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _filter = filter;
+      }
+      DS18Filter* getFilter() const { return _filter; }
+
+      // Get a copy of the read counters, which are updated without logging: see also getOneWire()->health() for the bus
+      Health getHealth() const;
+      void clearHealth();
+
       float getThreshold() const { return _threshold; }
 
       /**
        * @brief Set the temperature change threshold to consider a change relevant enough to trigger the callback
        * @param threshold The temperature change threshold in degrees Celsius, default is MYCILA_DS18_RELEVANT_TEMPERATURE_CHANGE
        */
-      void setThreshold(float threshold) { _threshold = threshold; }
+      void setThreshold(float threshold) {
+        _threshold = threshold;
+        _rawThreshold = _toRawThreshold(threshold);
+      }
+
+      // Same as setThreshold() in 1/16 °C: the change detection is done in integer math
+      void setRawThreshold(int16_t threshold) {
+        _threshold = threshold / 16.0f;
+        _rawThreshold = threshold;
+      }
+      int16_t getRawThreshold() const { return _rawThreshold; }
+
+      /**
+       * @brief Set the resolution of the sensor
+       * Lower resolutions convert faster: 94 ms at 9 bits, 188 ms at 10 bits, 375 ms at 11 bits and 750 ms at 12 bits.
+       * @param bits The resolution in bits, from 9 to 12
+       * @param persist true to also copy the configuration to the sensor EEPROM so that it is kept after a power cycle
+       * @return true if the resolution was changed, false if the sensor does not support it (DS18S20) or on bus error
+       */
+      bool setResolution(uint8_t bits, bool persist = false);
+      uint8_t getResolution() const { return _resolution; }
+
+      // Get the conversion time in milliseconds matching the sensor resolution
+      uint32_t getConversionTime() const { return getConversionTime(_deviceAddress, _resolution); }
+      // Get the conversion time in milliseconds of a sensor (its model is the low byte of the address) at a resolution
+      static uint32_t getConversionTime(uint64_t address, uint8_t resolution);
+
+      /**
+       * @brief Program the hardware alarm thresholds (TH / TL registers) of the sensor
+       * After each conversion, the sensor flags itself in alarm if the temperature is <= low or >= high (integer part, in degrees Celsius).
+       * Flagged sensors are found with an alarm search: see DS18Bus::readAlarms().
+       * @param low The low alarm threshold in degrees Celsius
+       * @param high The high alarm threshold in degrees Celsius
+       * @param persist true to also copy the thresholds to the sensor EEPROM so that they are kept after a power cycle
+       * @return true if the thresholds were written
+       */
+      bool setAlarm(int8_t low, int8_t high, bool persist = false);
+      int8_t getAlarmLow() const { return _alarmLow; }
+      int8_t getAlarmHigh() const { return _alarmHigh; }
 
 #ifdef MYCILA_JSON_SUPPORT
       void toJson(const JsonObject& root) const;
 #endif
 
     private:
+      friend class DS18Bus;
+      friend class DS18MultiBus;
+
       OneWire32* _oneWire = nullptr;
+      DS18Bus* _bus = nullptr;
       bool _ownOneWire = true;
       uint64_t _deviceAddress = 0;
       gpio_num_t _pin = GPIO_NUM_NC;
       bool _enabled = false;
       const char* _name = "Unknown";
-      float _temperature = 0;
+      // threshold as set by the user, and in 1/16 °C for the comparison
       float _threshold = MYCILA_DS18_RELEVANT_TEMPERATURE_CHANGE;
-      uint32_t _lastTime = 0;
+      int16_t _rawThreshold = _toRawThreshold(MYCILA_DS18_RELEVANT_TEMPERATURE_CHANGE);
       uint32_t _expirationDelay = 0;
+      uint32_t _requestTime = 0;
+      bool _conversionPolling = false;
+      // adaptive polling
+      uint32_t _minInterval = 0;
+      uint32_t _maxInterval = 0;
+      uint32_t _interval = 0;
+      uint32_t _lastPoll = 0;
+      int16_t _pollRaw = 0;
+      bool _pollPrimed = false;
+      bool _requested = false;
+      uint8_t _resolution = MYCILA_DS18_MAX_RESOLUTION;
+      bool _parasite = false;
+      int8_t _alarmLow = 0;
+      int8_t _alarmHigh = 0;
       DS18ChangeCallback _callback = nullptr;
-      std::mutex _mutex;
+      DS18RawChangeCallback _rawCallback = nullptr;
+      DS18HistoryBase* _history = nullptr;
+      DS18Filter* _filter = nullptr;
+      OneWire32::Decoder _decoder = OneWire32::decode12;
+      uint8_t _fastRead = 0;
+      uint8_t _fastReadCount = 0;
+      Health _health = {};
+      int64_t _cycleStart = 0;
+      mutable std::mutex _mutex;
+      OneWire32::Transaction _readTx;
+      OneWire32::Transaction _convertTx;
+      uint8_t _readFrame[10];
+      uint8_t _convertFrame[10];
+      uint8_t _scratchpad[9];
+      // return value of _process() for the last readAsync(), set by the completion callback
+      bool _readAsyncOk = false;
+      TaskHandle_t _task = nullptr;
+      SemaphoreHandle_t _taskStopper = nullptr;
+      uint32_t _taskPeriod = 0;
+      std::atomic<bool> _taskStop{false};
+
+      // seqlock protecting the last reading: odd while being written
+      std::atomic<uint32_t> _seq{0};
+      std::atomic<int16_t> _raw{0};
+      std::atomic<uint32_t> _lastTime{0};
+      std::atomic<uint8_t> _lastResult{OneWire32::Result::OK};
+
+      static void _taskLoop(void* arg);
+      static void _onReadComplete(OneWire32::Transaction& tx, void* arg);
+      static void _onConvertComplete(OneWire32::Transaction& tx, void* arg);
+
+      // search the bus for the first DS18 sensor
+      bool _search(uint8_t maxSearchCount);
+      // a change is relevant if it is strictly greater than the threshold: truncating it to 1/16 °C keeps the same behavior.
+      // Clamped to the int16_t range before the cast.
+      static constexpr int16_t _toRawThreshold(float threshold) {
+        return threshold * 16 >= INT16_MAX ? INT16_MAX : (threshold * 16 > INT16_MIN ? static_cast<int16_t>(threshold * 16) : INT16_MIN);
+      }
+      // read the resolution and the alarm thresholds from the sensor scratchpad: returns false if the sensor does not answer
+      bool _readConfiguration();
+      // write the alarm thresholds and the resolution: must be called with _mutex held
+      bool _writeConfiguration(int8_t low, int8_t high, uint8_t bits, bool persist);
+      // start a new conversion: must be called with _mutex held
+      void _request();
+      // check if the last conversion is complete: must be called with _mutex held
+      bool _converted();
+      // adaptive polling: check if the sensor is due, starting the conversion just in time: must be called with _mutex and the bus lock held
+      bool _due();
+      // adaptive polling: compute the next interval after a read attempt: must be called with _mutex held
+      void _adapt(bool ok, int16_t raw);
+      // read the temperature (fast or full read): must be called with _mutex and the bus lock held, on the routed pin
+      OneWire32::Result _getTemp(int16_t& raw);
+      // process a scratchpad read result started at _cycleStart: must be called with _mutex held
+      bool _process(OneWire32::Result result, int16_t raw);
+      // publish a new reading: must be called with _mutex held (single writer)
+      void _publish(int16_t raw, uint32_t time, OneWire32::Result result);
+
+      uint32_t _elapsed(const Snapshot& snapshot) const { return _enabled ? millis() - snapshot.time : 0; }
+      bool _expired(const Snapshot& snapshot) const { return _expirationDelay > 0 && (_elapsed(snapshot) >= _expirationDelay * 1000); }
+      bool _valid(const Snapshot& snapshot) const { return _enabled && snapshot.time > 0 && !_expired(snapshot); }
   };
 } // namespace Mycila
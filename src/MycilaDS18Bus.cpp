@@ -0,0 +1,349 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) Mathieu Carbou
+ */
+#include <MycilaDS18Bus.h>
+
+#include <esp_timer.h>
+
+#include <algorithm>
+
+#define TAG "DS18"
+
+#ifndef GPIO_IS_VALID_OUTPUT_GPIO
+  #define GPIO_IS_VALID_OUTPUT_GPIO(gpio_num) ((gpio_num >= 0) && \
+                                               (((1ULL << (gpio_num)) & SOC_GPIO_VALID_OUTPUT_GPIO_MASK) != 0))
+#endif
+
+void Mycila::DS18Bus::begin(const int8_t pin) {
+  if (_enabled)
+    return;
+
+  if (!GPIO_IS_VALID_OUTPUT_GPIO(pin)) {
+    ESP_LOGE(TAG, "Disable DS18 bus: Invalid pin: %" PRId8, pin);
+    return;
+  }
+
+  _oneWire = new OneWire32(pin);
+  _pin = (gpio_num_t)pin;
+  _ownOneWire = true;
+  _detectPowerSupply();
+  _request();
+
+  ESP_LOGI(TAG, "DS18 bus @ pin %d enabled!", pin);
+  _enabled = true;
+}
+
+void Mycila::DS18Bus::begin(OneWire32* oneWire) {
+  begin(oneWire, oneWire->pin());
+}
+
+void Mycila::DS18Bus::begin(OneWire32* oneWire, const int8_t pin) {
+  if (_enabled)
+    return;
+
+  _oneWire = oneWire;
+  _pin = (gpio_num_t)pin;
+  _ownOneWire = false;
+  _detectPowerSupply();
+  _request();
+
+  ESP_LOGI(TAG, "DS18 bus @ pin %d enabled!", _pin);
+  _enabled = true;
+}
+
+void Mycila::DS18Bus::end() {
+  if (_enabled) {
+    DS18* sensors[MYCILA_DS18_BUS_MAX_SENSORS];
+    size_t count;
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _enabled = false;
+      count = _count;
+      for (size_t i = 0; i < _count; i++) {
+        sensors[i] = _sensors[i];
+        _sensors[i]->_bus = nullptr;
+        _sensors[i] = nullptr;
+      }
+      _count = 0;
+    }
+
+    // the sensors use the driver owned by the bus: disable them before deleting it
+    // (outside of the bus lock, since they are not registered anymore)
+    if (_ownOneWire)
+      for (size_t i = 0; i < count; i++)
+        sensors[i]->end();
+
+    // the completion callback of a pending conversion refers to the bus
+    _oneWire->wait(_convertTx);
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    const gpio_num_t pin = _pin;
+    if (_ownOneWire) {
+      delete _oneWire;
+      // Give some time for RMT channels to be properly released
+      vTaskDelay(pdMS_TO_TICKS(10));
+    }
+    _oneWire = nullptr;
+    _pin = GPIO_NUM_NC;
+    ESP_LOGI(TAG, "DS18 bus @ pin %d disabled!", pin);
+  }
+}
+
+bool Mycila::DS18Bus::add(DS18& sensor) {
+  std::lock_guard<std::mutex> lock(_mutex);
+
+  if (!_enabled || !sensor.isEnabled() || sensor.getOneWire() != _oneWire || sensor.getPin() != _pin)
+    return false;
+
+  if (sensor._bus)
+    return sensor._bus == this;
+
+  if (_count >= MYCILA_DS18_BUS_MAX_SENSORS) {
+    ESP_LOGE(TAG, "DS18 bus @ pin %d is full!", _pin);
+    return false;
+  }
+
+  _sensors[_count++] = &sensor;
+  sensor._bus = this;
+  return true;
+}
+
+bool Mycila::DS18Bus::remove(DS18& sensor) {
+  std::lock_guard<std::mutex> lock(_mutex);
+
+  for (size_t i = 0; i < _count; i++) {
+    if (_sensors[i] == &sensor) {
+      // keep the registration order
+      for (size_t j = i + 1; j < _count; j++)
+        _sensors[j - 1] = _sensors[j];
+      _sensors[--_count] = nullptr;
+      sensor._bus = nullptr;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+bool Mycila::DS18Bus::scan(DS18BusScanCallback callback) {
+  std::lock_guard<std::mutex> lock(_mutex);
+
+  if (!_enabled)
+    return false;
+
+  uint64_t known[MYCILA_DS18_BUS_MAX_SENSORS];
+  for (size_t i = 0; i < _count; i++)
+    known[i] = _sensors[i]->getAddress();
+
+  std::lock_guard<OneWire32> busLock(*_oneWire);
+  if (!_oneWire->route(_pin))
+    return false;
+  return _oneWire->diff(
+    known,
+    _count,
+    [](uint64_t address, bool added, void* arg) {
+      ESP_LOGI(TAG, "DS18 bus: 0x%llx %s", address, added ? "added" : "removed");
+      DS18BusScanCallback* cb = static_cast<DS18BusScanCallback*>(arg);
+      if (*cb)
+        (*cb)(address, added);
+    },
+    &callback);
+}
+
+uint32_t Mycila::DS18Bus::getConversionTime() const {
+  uint32_t time = 0;
+  for (size_t i = 0; i < _count; i++)
+    time = std::max(time, _sensors[i]->getConversionTime());
+  return _count ? time : MYCILA_DS18_CONVERSION_TIME_MS;
+}
+
+size_t Mycila::DS18Bus::read() {
+  std::lock_guard<std::mutex> lock(_mutex);
+
+  if (!_enabled || !_converted())
+    return 0;
+
+  size_t count = 0;
+
+  // sensors with an adaptive polling interval are only read when due
+  for (size_t i = 0; i < _count; i++)
+    if (_read(*_sensors[i], true))
+      count++;
+
+  // start the next broadcast conversion for all the sensors at once
+  _request();
+
+  return count;
+}
+
+size_t Mycila::DS18Bus::readAlarms() {
+  std::lock_guard<std::mutex> lock(_mutex);
+
+  if (!_enabled || !_converted())
+    return 0;
+
+  // find the sensors which flagged themselves in alarm after the last conversion
+  uint64_t flagged[MYCILA_DS18_BUS_MAX_SENSORS];
+  size_t found = 0;
+  {
+    std::lock_guard<OneWire32> busLock(*_oneWire);
+    if (_oneWire->route(_pin)) {
+      OneWire32::Search search;
+      search.cmd = 0xEC; // Alarm Search
+      uint64_t addr;
+      while (found < MYCILA_DS18_BUS_MAX_SENSORS && _oneWire->next(search, addr))
+        flagged[found++] = addr;
+      if (search.failed)
+        ESP_LOGW(TAG, "Alarm search failed on pin %d", _pin);
+    }
+  }
+
+  // only read the flagged sensors
+  size_t count = 0;
+  for (size_t f = 0; f < found; f++)
+    for (size_t i = 0; i < _count; i++)
+      if (_sensors[i]->_deviceAddress == flagged[f] && _read(*_sensors[i]))
+        count++;
+
+  _request();
+
+  return count;
+}
+
+bool Mycila::DS18Bus::_converted() {
+  // wait for the broadcast conversion to complete (the slowest sensor resolution drives the bus)
+  bool done = false;
+  if (!_conversionPolling || _oneWire->pin() != _pin || !_oneWire->poll(done))
+    done = millis() - _requestTime >= getConversionTime();
+  return done;
+}
+
+bool Mycila::DS18Bus::_read(DS18& sensor, bool due) {
+  std::lock_guard<std::mutex> sensorLock(sensor._mutex);
+  if (!sensor._enabled)
+    return false;
+  std::lock_guard<OneWire32> busLock(*_oneWire);
+  if (due && sensor._maxInterval && !sensor._due())
+    return false;
+  sensor._cycleStart = esp_timer_get_time();
+  int16_t read = 0;
+  OneWire32::Result result = _oneWire->route(_pin) ? sensor._getTemp(read) : OneWire32::Result::DRIVER;
+  return sensor._process(result, read);
+}
+
+void Mycila::DS18Bus::_detectPowerSupply() {
+  std::lock_guard<OneWire32> busLock(*_oneWire);
+  bool parasite = false;
+  if (_oneWire->route(_pin) && _oneWire->readPowerSupply(parasite) && parasite) {
+    // the whole bus converts under one strong pull-up window after the broadcast Convert T
+    ESP_LOGI(TAG, "DS18 bus @ pin %d: parasite-powered device detected", _pin);
+    if (!_oneWire->setParasite(true))
+      ESP_LOGW(TAG, "DS18 bus @ pin %d: Too many pins to enable parasite mode", _pin);
+  }
+  _parasite = parasite;
+}
+
+void Mycila::DS18Bus::_request() {
+  std::lock_guard<OneWire32> busLock(*_oneWire);
+  if (_oneWire->route(_pin))
+    _oneWire->request();
+  _requestTime = millis();
+}
+
+void Mycila::DS18Bus::_onConvertComplete(OneWire32::Transaction& tx, void* arg) {
+  if (tx.result() == OneWire32::Result::OK)
+    static_cast<DS18Bus*>(arg)->_requestTime = millis();
+}
+
+bool Mycila::DS18MultiBus::add(DS18Bus& bus) {
+  std::lock_guard<std::mutex> lock(_mutex);
+
+  if (!bus.isEnabled())
+    return false;
+
+  for (size_t i = 0; i < _count; i++)
+    if (_buses[i] == &bus)
+      return true;
+
+  if (_count >= MYCILA_DS18_MULTIBUS_MAX_BUSES)
+    return false;
+
+  _buses[_count++] = &bus;
+  return true;
+}
+
+bool Mycila::DS18MultiBus::remove(DS18Bus& bus) {
+  std::lock_guard<std::mutex> lock(_mutex);
+
+  for (size_t i = 0; i < _count; i++) {
+    if (_buses[i] == &bus) {
+      for (size_t j = i + 1; j < _count; j++)
+        _buses[j - 1] = _buses[j];
+      _buses[--_count] = nullptr;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+size_t Mycila::DS18MultiBus::read() {
+  std::lock_guard<std::mutex> lock(_mutex);
+
+  if (!_count)
+    return 0;
+
+  // the buses are locked in registration order for the whole cycle
+  std::unique_lock<std::mutex> busLocks[MYCILA_DS18_MULTIBUS_MAX_BUSES];
+  for (size_t b = 0; b < _count; b++)
+    busLocks[b] = std::unique_lock<std::mutex>(_buses[b]->_mutex);
+
+  const int64_t start = esp_timer_get_time();
+
+  // start the broadcast conversions on all the buses at once
+  uint32_t conversionTime = 0;
+  for (size_t b = 0; b < _count; b++) {
+    DS18Bus* bus = _buses[b];
+    if (!bus->_enabled)
+      continue;
+    bus->_convertTx.clear().route(bus->_pin).reset().write(bus->_convertFrame, sizeof(bus->_convertFrame), true);
+    bus->_convertTx.onComplete(DS18Bus::_onConvertComplete, bus);
+    if (bus->_oneWire->submit(bus->_convertTx))
+      conversionTime = std::max(conversionTime, bus->getConversionTime());
+  }
+  for (size_t b = 0; b < _count; b++)
+    _buses[b]->_oneWire->wait(_buses[b]->_convertTx);
+
+  // wait once for the slowest conversion
+  vTaskDelay(pdMS_TO_TICKS(conversionTime));
+
+  // read the scratchpads: sensors of a bus are read one after the other, but all the buses in parallel
+  size_t rounds = 0;
+  for (size_t b = 0; b < _count; b++)
+    rounds = std::max(rounds, _buses[b]->_count);
+
+  size_t count = 0;
+  for (size_t k = 0; k < rounds; k++) {
+    DS18* sensors[MYCILA_DS18_MULTIBUS_MAX_BUSES] = {nullptr};
+    for (size_t b = 0; b < _count; b++) {
+      DS18Bus* bus = _buses[b];
+      if (bus->_enabled && k < bus->_count && bus->_sensors[k]->readAsync())
+        sensors[b] = bus->_sensors[k];
+    }
+    for (size_t b = 0; b < _count; b++) {
+      if (sensors[b]) {
+        // wait() returns once the completion callback has processed the reading: filtered readings are not counted
+        _buses[b]->_oneWire->wait(sensors[b]->_readTx);
+        std::lock_guard<std::mutex> sensorLock(sensors[b]->_mutex);
+        if (sensors[b]->_readAsyncOk)
+          count++;
+      }
+    }
+  }
+
+  _lastCycleTime = esp_timer_get_time() - start;
+  ESP_LOGD(TAG, "Read %u sensors on %u buses in %" PRIu32 " us", count, _count, _lastCycleTime);
+
+  return count;
+}
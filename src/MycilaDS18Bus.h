@@ -0,0 +1,140 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) Mathieu Carbou
+ */
+#pragma once
+
+#include "MycilaDS18.h"
+
+#include <atomic>
+#include <mutex>
+
+// Maximum number of DS18 sensors that can be registered on a bus
+#ifndef MYCILA_DS18_BUS_MAX_SENSORS
+  #define MYCILA_DS18_BUS_MAX_SENSORS 32
+#endif
+
+// Maximum number of buses that can be registered in a DS18MultiBus
+#ifndef MYCILA_DS18_MULTIBUS_MAX_BUSES
+  #define MYCILA_DS18_MULTIBUS_MAX_BUSES 8
+#endif
+
+namespace Mycila {
+  // callback signature for bus scans: "added" is true for a new device, false for a registered sensor which is gone
+  typedef std::function<void(uint64_t address, bool added)> DS18BusScanCallback;
+
+  // A bus groups several DS18 sensors sharing the same OneWire32 instance.
+  // Instead of one addressed conversion per sensor, the bus issues a single broadcast conversion (SKIP ROM + Convert T)
+  // for all the sensors, waits once for the conversion to complete and then reads all the scratchpads back-to-back.
+  // Samples are time-coherent and a cycle of N sensors takes roughly one conversion time.
+  class DS18Bus {
+    public:
+
+      ~DS18Bus() { end(); }
+
+      // Create and own a OneWire32 instance on the given pin
+      void begin(const int8_t pin);
+      // Use an existing OneWire32 instance
+      void begin(OneWire32* oneWire);
+      // Use an existing OneWire32 instance shared between several pins: the RMT channels are routed to the pin before each access
+      void begin(OneWire32* oneWire, const int8_t pin);
+      // Unregister the sensors: when the bus owns its OneWire32 instance, the sensors using it are also disabled (see DS18::end())
+      void end();
+
+      // Register a sensor which was started with begin(bus.getOneWire(), bus.getPin(), address)
+      // Returns false if the sensor is not enabled, not on this bus or if the bus is full
+      bool add(DS18& sensor);
+      bool remove(DS18& sensor);
+
+      // Read all the sensors of the bus (async and non-blocking)
+      // If the broadcast conversion is not yet complete, returns 0.
+      // Otherwise reads all the scratchpads, fires the sensor callbacks, starts a new broadcast conversion
+      // and returns the number of sensors successfully read.
+      // Sensors using an adaptive polling interval (see DS18::setAdaptivePolling()) are only read when due.
+      // This method can be called in the loop
+      size_t read();
+
+      // Read only the sensors in alarm (async and non-blocking), see DS18::setAlarm()
+      // Once the broadcast conversion is complete, an Alarm Search (0xEC) finds the sensors whose temperature is
+      // outside of their TH / TL thresholds: only those are read, then a new broadcast conversion is started.
+      // Returns the number of sensors successfully read, which is 0 when no sensor is in alarm.
+      // Sensors not in alarm are not refreshed and will expire: call read() from time to time to refresh all of them.
+      size_t readAlarms();
+
+      // Enumerate the bus once and compare with the registered sensors (hot-plug detection)
+      // Devices not registered on the bus are reported as added as soon as they are found.
+      // Registered sensors which are not on the bus anymore are reported as removed once the enumeration is complete.
+      // Returns false if the enumeration failed, in which case no removal is reported.
+      bool scan(DS18BusScanCallback callback);
+
+      // Poll the bus for the end of the broadcast conversion instead of waiting for the conversion time
+      // See DS18::setConversionPolling()
+      void setConversionPolling(bool enable) { _conversionPolling = enable; }
+      bool isConversionPolling() const { return _conversionPolling; }
+
+      // Get the time to wait for a broadcast conversion: the conversion time of the slowest sensor
+      uint32_t getConversionTime() const;
+
+      bool isEnabled() const { return _enabled; }
+      // true if a parasite-powered device was detected at begin(): see OneWire32::setStrongPullup()
+      bool isParasite() const { return _parasite; }
+      gpio_num_t getPin() const { return _pin; }
+      OneWire32* getOneWire() const { return _oneWire; }
+      size_t getSensorCount() const { return _count; }
+      DS18* getSensor(size_t index) const { return index < _count ? _sensors[index] : nullptr; }
+
+    private:
+      friend class DS18MultiBus;
+
+      OneWire32* _oneWire = nullptr;
+      gpio_num_t _pin = GPIO_NUM_NC;
+      bool _ownOneWire = true;
+      bool _enabled = false;
+      DS18* _sensors[MYCILA_DS18_BUS_MAX_SENSORS] = {nullptr};
+      size_t _count = 0;
+      // also written by the engine task when an async broadcast conversion completes
+      std::atomic<uint32_t> _requestTime{0};
+      bool _conversionPolling = false;
+      bool _parasite = false;
+      std::mutex _mutex;
+      OneWire32::Transaction _convertTx;
+      uint8_t _convertFrame[2] = {0xCC, 0x44}; // SKIP ROM + Convert T
+
+      // detect parasite-powered devices with a broadcast Read Power Supply
+      void _detectPowerSupply();
+      // start a new broadcast conversion: must be called with _mutex held
+      void _request();
+      // check if the broadcast conversion is complete: must be called with _mutex held
+      bool _converted();
+      // read and process the scratchpad of a registered sensor, skipped if due is true and the sensor is not due: must be called with _mutex held
+      bool _read(DS18& sensor, bool due = false);
+      static void _onConvertComplete(OneWire32::Transaction& tx, void* arg);
+  };
+
+  // Acquisition across several buses, each one with its own OneWire32 instance and RMT channels.
+  // Conversions and scratchpad reads are started on all the buses at the same time and executed concurrently
+  // by the OneWire32 engine tasks, so a cycle takes as long as the slowest bus instead of the sum of all the buses.
+  class DS18MultiBus {
+    public:
+      bool add(DS18Bus& bus);
+      bool remove(DS18Bus& bus);
+
+      // Run a full acquisition cycle on all the buses (blocking):
+      // broadcast conversion on all the buses, wait for the slowest conversion, then read all the scratchpads.
+      // Sensor callbacks are called from the OneWire32 engine tasks.
+      // Returns the number of sensors successfully read.
+      size_t read();
+
+      // Wall time of the last cycle in microseconds
+      uint32_t getLastCycleTime() const { return _lastCycleTime; }
+
+      size_t getBusCount() const { return _count; }
+      DS18Bus* getBus(size_t index) const { return index < _count ? _buses[index] : nullptr; }
+
+    private:
+      DS18Bus* _buses[MYCILA_DS18_MULTIBUS_MAX_BUSES] = {nullptr};
+      size_t _count = 0;
+      uint32_t _lastCycleTime = 0;
+      std::mutex _mutex;
+  };
+} // namespace Mycila
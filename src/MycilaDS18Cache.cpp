@@ -0,0 +1,119 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) Mathieu Carbou
+ */
+#include <MycilaDS18Cache.h>
+
+#include <esp32-hal.h>
+#include <nvs.h>
+
+#include <string.h>
+
+#define TAG "DS18"
+
+size_t Mycila::DS18NVSStorage::load(DS18CacheEntry* entries, size_t max) {
+  nvs_handle_t handle;
+  if (nvs_open(_ns, NVS_READONLY, &handle) != ESP_OK)
+    return 0;
+  size_t length = max * sizeof(DS18CacheEntry);
+  const esp_err_t err = nvs_get_blob(handle, _key, entries, &length);
+  nvs_close(handle);
+  if (err != ESP_OK) {
+    if (err != ESP_ERR_NVS_NOT_FOUND)
+      ESP_LOGW(TAG, "Unable to load the address cache: %d", err);
+    return 0;
+  }
+  return length / sizeof(DS18CacheEntry);
+}
+
+bool Mycila::DS18NVSStorage::save(const DS18CacheEntry* entries, size_t count) {
+  nvs_handle_t handle;
+  esp_err_t err = nvs_open(_ns, NVS_READWRITE, &handle);
+  if (err == ESP_OK) {
+    err = count ? nvs_set_blob(handle, _key, entries, count * sizeof(DS18CacheEntry)) : nvs_erase_key(handle, _key);
+    if (err == ESP_ERR_NVS_NOT_FOUND)
+      err = ESP_OK;
+    if (err == ESP_OK)
+      err = nvs_commit(handle);
+    nvs_close(handle);
+  }
+  if (err != ESP_OK)
+    ESP_LOGW(TAG, "Unable to save the address cache: %d", err);
+  return err == ESP_OK;
+}
+
+size_t Mycila::DS18MemoryStorage::load(DS18CacheEntry* entries, size_t max) {
+  const size_t count = _count < max ? _count : max;
+  memcpy(entries, _entries, count * sizeof(DS18CacheEntry));
+  return count;
+}
+
+bool Mycila::DS18MemoryStorage::save(const DS18CacheEntry* entries, size_t count) {
+  if (count > MYCILA_DS18_CACHE_MAX_ENTRIES)
+    return false;
+  memcpy(_entries, entries, count * sizeof(DS18CacheEntry));
+  _count = count;
+  return true;
+}
+
+void Mycila::DS18Cache::begin() {
+  std::lock_guard<std::mutex> lock(_mutex);
+  _count = _storage->load(_entries, MYCILA_DS18_CACHE_MAX_ENTRIES);
+  _dirty = false;
+  ESP_LOGD(TAG, "Loaded %d cached addresses", _count);
+}
+
+uint64_t Mycila::DS18Cache::find(int8_t pin, size_t index) const {
+  std::lock_guard<std::mutex> lock(_mutex);
+  for (size_t i = 0; i < _count; i++)
+    if (_entries[i].pin == pin && index-- == 0)
+      return _entries[i].address;
+  return 0;
+}
+
+bool Mycila::DS18Cache::put(int8_t pin, uint64_t address) {
+  std::lock_guard<std::mutex> lock(_mutex);
+
+  for (size_t i = 0; i < _count; i++)
+    if (_entries[i].pin == pin && _entries[i].address == address)
+      return true;
+
+  if (_count >= MYCILA_DS18_CACHE_MAX_ENTRIES)
+    return false;
+
+  _entries[_count++] = {address, pin};
+  _dirty = true;
+  return true;
+}
+
+bool Mycila::DS18Cache::remove(int8_t pin, uint64_t address) {
+  std::lock_guard<std::mutex> lock(_mutex);
+
+  for (size_t i = 0; i < _count; i++) {
+    if (_entries[i].pin == pin && _entries[i].address == address) {
+      for (size_t j = i + 1; j < _count; j++)
+        _entries[j - 1] = _entries[j];
+      _count--;
+      _dirty = true;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void Mycila::DS18Cache::clear() {
+  std::lock_guard<std::mutex> lock(_mutex);
+  _dirty = _dirty || _count > 0;
+  _count = 0;
+}
+
+bool Mycila::DS18Cache::commit() {
+  std::lock_guard<std::mutex> lock(_mutex);
+  if (!_dirty)
+    return true;
+  if (!_storage->save(_entries, _count))
+    return false;
+  _dirty = false;
+  return true;
+}
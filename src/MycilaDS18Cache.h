@@ -0,0 +1,99 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) Mathieu Carbou
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <mutex>
+
+// Maximum number of devices that can be kept in an address cache
+#ifndef MYCILA_DS18_CACHE_MAX_ENTRIES
+  #define MYCILA_DS18_CACHE_MAX_ENTRIES 16
+#endif
+
+// NVS namespace and key used by the default storage
+#ifndef MYCILA_DS18_CACHE_NVS_NAMESPACE
+  #define MYCILA_DS18_CACHE_NVS_NAMESPACE "ds18"
+#endif
+#ifndef MYCILA_DS18_CACHE_NVS_KEY
+  #define MYCILA_DS18_CACHE_NVS_KEY "addresses"
+#endif
+
+namespace Mycila {
+  // A device discovered on a pin.
+  // The model is the family code: the low byte of the address.
+  // The configuration (resolution, alarm thresholds) is not cached: it comes with the scratchpad read validating the device.
+  typedef struct {
+      uint64_t address;
+      int8_t pin;
+  } DS18CacheEntry;
+
+  // Storage backend of an address cache: the whole table is loaded and saved at once
+  class DS18CacheStorage {
+    public:
+      virtual ~DS18CacheStorage() = default;
+      // Load up to max entries and return the number of entries loaded
+      virtual size_t load(DS18CacheEntry* entries, size_t max) = 0;
+      virtual bool save(const DS18CacheEntry* entries, size_t count) = 0;
+  };
+
+  // Default storage: a blob in the NVS partition, which must be initialized (the Arduino core does it)
+  class DS18NVSStorage : public DS18CacheStorage {
+    public:
+      explicit DS18NVSStorage(const char* ns = MYCILA_DS18_CACHE_NVS_NAMESPACE, const char* key = MYCILA_DS18_CACHE_NVS_KEY) : _ns(ns), _key(key) {}
+      size_t load(DS18CacheEntry* entries, size_t max) override;
+      bool save(const DS18CacheEntry* entries, size_t count) override;
+
+    private:
+      const char* _ns;
+      const char* _key;
+  };
+
+  // Volatile storage, kept in RAM only: for testing or for applications persisting the entries themselves
+  class DS18MemoryStorage : public DS18CacheStorage {
+    public:
+      size_t load(DS18CacheEntry* entries, size_t max) override;
+      bool save(const DS18CacheEntry* entries, size_t count) override;
+      size_t getCount() const { return _count; }
+      const DS18CacheEntry* getEntries() const { return _entries; }
+
+    private:
+      DS18CacheEntry _entries[MYCILA_DS18_CACHE_MAX_ENTRIES];
+      size_t _count = 0;
+  };
+
+  // Cache of the devices discovered on each pin, so that the next boot can skip the ROM search.
+  // See DS18::begin(pin, cache): a cached device is validated with a single addressed scratchpad read,
+  // and the bus is only searched when the device does not answer.
+  class DS18Cache {
+    public:
+      explicit DS18Cache(DS18CacheStorage& storage) : _storage(&storage) {}
+
+      // Load the entries from the storage
+      void begin();
+
+      // Get the address of the index-th device cached for the pin, 0 if none
+      uint64_t find(int8_t pin, size_t index = 0) const;
+
+      // Add a device. Returns false if the cache is full.
+      bool put(int8_t pin, uint64_t address);
+      bool remove(int8_t pin, uint64_t address);
+      void clear();
+
+      // Save the entries to the storage if they were changed since the last load or commit
+      bool commit();
+
+      size_t getCount() const { return _count; }
+      bool isDirty() const { return _dirty; }
+
+    private:
+      DS18CacheStorage* _storage;
+      DS18CacheEntry _entries[MYCILA_DS18_CACHE_MAX_ENTRIES];
+      size_t _count = 0;
+      bool _dirty = false;
+      mutable std::mutex _mutex;
+  };
+} // namespace Mycila
@@ -0,0 +1,92 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) Mathieu Carbou
+ */
+#include <MycilaDS18Filter.h>
+
+// 85 °C in 1/16 °C
+#define MYCILA_DS18_POWER_ON_RAW 1360
+
+void Mycila::DS18Filter::setMedian(uint8_t size) {
+  if (size > MYCILA_DS18_FILTER_MAX_MEDIAN)
+    size = MYCILA_DS18_FILTER_MAX_MEDIAN;
+  // odd window: the median is a reading
+  if (size && !(size & 1))
+    size--;
+  _median = size > 1 ? size : 0;
+  _windowCount = 0;
+  _windowHead = 0;
+}
+
+void Mycila::DS18Filter::reset() {
+  _primed = false;
+  _rejected = 0;
+  _slewRemainder = 0;
+  _windowCount = 0;
+  _windowHead = 0;
+}
+
+bool Mycila::DS18Filter::apply(int16_t& raw, uint32_t time) {
+  if (_powerOn && raw == MYCILA_DS18_POWER_ON_RAW)
+    return false;
+
+  if (_primed && _maxJump) {
+    const int16_t jump = raw > _accepted ? raw - _accepted : _accepted - raw;
+    if (jump > _maxJump && ++_rejected <= _confirm)
+      return false;
+  }
+  _rejected = 0;
+
+  int16_t value = raw;
+
+  if (_median) {
+    _window[_windowHead] = raw;
+    _windowHead = (_windowHead + 1) % _median;
+    if (_windowCount < _median)
+      _windowCount++;
+    // insertion sort of a copy: the window is small
+    int16_t sorted[MYCILA_DS18_FILTER_MAX_MEDIAN];
+    for (uint8_t i = 0; i < _windowCount; i++) {
+      int16_t v = _window[i];
+      uint8_t j = i;
+      for (; j > 0 && sorted[j - 1] > v; j--)
+        sorted[j] = sorted[j - 1];
+      sorted[j] = v;
+    }
+    value = sorted[_windowCount / 2];
+  }
+
+  if (_primed && _slew) {
+    // budget in 1/1000 of 1/16 °C, 64-bit: the elapsed time can be large after a long gap.
+    // The part of the budget below a whole step is carried over while the output is limited,
+    // otherwise a slow rate at a short poll period would round down to 0 at each reading.
+    const int64_t budget = static_cast<int64_t>(_slew) * static_cast<int64_t>(time - _lastTime) + _slewRemainder;
+    const int64_t max = budget / 1000;
+    _slewRemainder = 0;
+    if (value > _last + max) {
+      value = _last + max;
+      _slewRemainder = budget - max * 1000;
+    } else if (value < _last - max) {
+      value = _last - max;
+      _slewRemainder = budget - max * 1000;
+    }
+  }
+
+  // the slew rate applies to the readings before averaging
+  const int16_t limited = value;
+
+  if (_alpha) {
+    if (!_primed)
+      _ema = static_cast<int32_t>(value) * 256;
+    else
+      _ema += (static_cast<int32_t>(value) * 256 - _ema) * _alpha / 256;
+    value = (_ema + (_ema >= 0 ? 128 : -128)) / 256;
+  }
+
+  _primed = true;
+  _accepted = raw;
+  _last = limited;
+  _lastTime = time;
+  raw = value;
+  return true;
+}
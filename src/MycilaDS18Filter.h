@@ -0,0 +1,76 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) Mathieu Carbou
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Maximum window of the median filter
+#ifndef MYCILA_DS18_FILTER_MAX_MEDIAN
+  #define MYCILA_DS18_FILTER_MAX_MEDIAN 7
+#endif
+
+namespace Mycila {
+  // Filter chain applied to the readings of a sensor before the change detection: see DS18::setFilter().
+  // Stages are applied in this order, each one being disabled by default:
+  // power-on value rejection, spike rejection, median-of-N, slew-rate limit and exponential moving average.
+  // All the computations are done in 1/16 °C integer math and the state has a fixed size.
+  class DS18Filter {
+    public:
+      // Reject the 85 °C power-on value, which is reported when a conversion did not run
+      void setPowerOnRejection(bool enable) { _powerOn = enable; }
+
+      /**
+       * @brief Reject a reading jumping from the last accepted one by more than maxJump
+       * A real step is accepted once confirmed by confirm consecutive rejected readings.
+       * @param maxJump Maximum jump in 1/16 °C, 0 to disable
+       * @param confirm Number of consecutive rejections after which the reading is accepted
+       */
+      void setSpikeRejection(int16_t maxJump, uint8_t confirm = 3) {
+        _maxJump = maxJump;
+        _confirm = confirm;
+      }
+
+      // Median of the last size readings (odd, up to MYCILA_DS18_FILTER_MAX_MEDIAN), 0 or 1 to disable
+      void setMedian(uint8_t size);
+
+      // Limit the change between 2 readings to maxPerSecond (1/16 °C per second), 0 to disable
+      void setSlewRate(int16_t maxPerSecond) {
+        _slew = maxPerSecond;
+        _slewRemainder = 0;
+      }
+
+      // Exponential moving average: y += alpha / 256 * (x - y), 0 to disable
+      void setEMA(uint8_t alpha) { _alpha = alpha; }
+
+      // Filter a reading taken at time (milliseconds): returns false if the reading is rejected
+      bool apply(int16_t& raw, uint32_t time);
+
+      // Forget the previous readings
+      void reset();
+
+    private:
+      bool _powerOn = false;
+      int16_t _maxJump = 0;
+      uint8_t _confirm = 3;
+      uint8_t _median = 0;
+      int16_t _slew = 0;
+      uint8_t _alpha = 0;
+
+      bool _primed = false;
+      // last accepted reading and last reading before averaging
+      int16_t _accepted = 0;
+      int16_t _last = 0;
+      uint32_t _lastTime = 0;
+      // slew-rate budget left from the last limited reading, in 1/1000 of 1/16 °C
+      int32_t _slewRemainder = 0;
+      uint8_t _rejected = 0;
+      int16_t _window[MYCILA_DS18_FILTER_MAX_MEDIAN];
+      uint8_t _windowCount = 0;
+      uint8_t _windowHead = 0;
+      // EMA state in 1/256 of 1/16 °C
+      int32_t _ema = 0;
+  };
+} // namespace Mycila
@@ -0,0 +1,216 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) Mathieu Carbou
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef MYCILA_JSON_SUPPORT
+  #include <ArduinoJson.h>
+#endif
+
+#include <mutex>
+
+// Number of aggregation windows of a history
+#ifndef MYCILA_DS18_HISTORY_WINDOWS
+  #define MYCILA_DS18_HISTORY_WINDOWS 2
+#endif
+
+namespace Mycila {
+  // Receives the successful readings of a sensor: see DS18::setHistory()
+  class DS18HistoryBase {
+    public:
+      virtual ~DS18HistoryBase() = default;
+      // temperature in 1/16 °C, time in milliseconds
+      virtual void add(int16_t raw, uint32_t time) = 0;
+  };
+
+  // Fixed-memory history of the last N readings of a sensor, with min / max / mean aggregates over rolling time windows.
+  // Readings are kept in fixed-point (1/16 °C, 8 bytes per reading with its time). Each window (by default the last minute and the last hour)
+  // covers the readings of the ring buffer taken less than its duration before the last reading: its sum and count are updated incrementally
+  // at each reading, and its min / max are only rescanned when an expiring reading was the min or the max.
+  // A window longer than the time covered by the ring buffer only aggregates the readings still kept.
+  template <size_t N>
+  class DS18History : public DS18HistoryBase {
+    public:
+      typedef struct {
+          uint32_t time;
+          int16_t raw;
+      } Sample;
+
+      typedef struct {
+          // time of the oldest reading in the window, in milliseconds
+          uint32_t start;
+          int16_t min;
+          int16_t max;
+          int32_t sum;
+          uint32_t count;
+          // mean in 1/16 °C, 0 if no reading
+          int16_t mean() const { return count ? sum / static_cast<int32_t>(count) : 0; }
+      } Aggregate;
+
+      DS18History() {
+        // 1 minute, then 1 hour
+        for (size_t w = 0; w < MYCILA_DS18_HISTORY_WINDOWS; w++)
+          _windows[w] = w ? 3600 : 60;
+      }
+
+      // Set the duration of a window in seconds, 0 to disable it: its aggregate is recomputed from the readings kept
+      void setWindow(size_t index, uint32_t seconds) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (index < MYCILA_DS18_HISTORY_WINDOWS) {
+          _windows[index] = seconds;
+          _rolling[index] = {};
+          if (seconds && _count) {
+            // walk back from the last reading
+            const uint32_t last = _sample(_total - 1).time;
+            for (uint32_t i = 0; i < _count && last - _sample(_total - 1 - i).time < seconds * 1000; i++) {
+              _rolling[index].sum += _sample(_total - 1 - i).raw;
+              _rolling[index].count++;
+            }
+            _rolling[index].dirty = true;
+          }
+        }
+      }
+      uint32_t getWindow(size_t index) const { return index < MYCILA_DS18_HISTORY_WINDOWS ? _windows[index] : 0; }
+
+      void add(int16_t raw, uint32_t time) override {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        // the oldest reading is about to be overwritten: remove it from the windows still covering it
+        if (_count == N)
+          for (size_t w = 0; w < MYCILA_DS18_HISTORY_WINDOWS; w++)
+            if (_rolling[w].count == N)
+              _expire(_rolling[w]);
+
+        _samples[_total % N] = {time, raw};
+        _total++;
+        if (_count < N)
+          _count++;
+
+        for (size_t w = 0; w < MYCILA_DS18_HISTORY_WINDOWS; w++) {
+          if (!_windows[w])
+            continue;
+          Window& window = _rolling[w];
+          if (!window.count) {
+            window.min = raw;
+            window.max = raw;
+          } else if (!window.dirty) {
+            if (raw < window.min)
+              window.min = raw;
+            if (raw > window.max)
+              window.max = raw;
+          }
+          window.sum += raw;
+          window.count++;
+          // expire the readings which went out of the window
+          while (window.count > 1 && time - _sample(_total - window.count).time >= _windows[w] * 1000)
+            _expire(window);
+        }
+      }
+
+      void clear() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _total = 0;
+        _count = 0;
+        for (size_t w = 0; w < MYCILA_DS18_HISTORY_WINDOWS; w++)
+          _rolling[w] = {};
+      }
+
+      size_t size() const { return _count; }
+      static constexpr size_t capacity() { return N; }
+
+      // Copy the readings taken between from and to (milliseconds, inclusive), oldest first: returns the number of readings copied
+      size_t query(uint32_t from, uint32_t to, Sample* samples, size_t max) const {
+        std::lock_guard<std::mutex> lock(_mutex);
+        size_t copied = 0;
+        for (size_t i = 0; i < _count && copied < max; i++) {
+          const Sample& sample = _sample(_total - _count + i);
+          if (sample.time - from <= to - from)
+            samples[copied++] = sample;
+        }
+        return copied;
+      }
+
+      // Aggregate of a window, ending at the last reading (count is 0 if none)
+      Aggregate getAggregate(size_t index) const {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return index < MYCILA_DS18_HISTORY_WINDOWS ? _aggregate(index) : Aggregate{};
+      }
+
+#ifdef MYCILA_JSON_SUPPORT
+      // Export the readings as [time, temperature] pairs and the window aggregates
+      void toJson(const JsonObject& root) const {
+        std::lock_guard<std::mutex> lock(_mutex);
+        const JsonArray samples = root["samples"].to<JsonArray>();
+        for (size_t i = 0; i < _count; i++) {
+          const Sample& sample = _sample(_total - _count + i);
+          const JsonArray pair = samples.add<JsonArray>();
+          pair.add(sample.time);
+          pair.add(sample.raw / 16.0f);
+        }
+        const JsonArray windows = root["windows"].to<JsonArray>();
+        for (size_t w = 0; w < MYCILA_DS18_HISTORY_WINDOWS; w++) {
+          const Aggregate aggregate = _aggregate(w);
+          const JsonObject window = windows.add<JsonObject>();
+          window["duration"] = _windows[w];
+          window["start"] = aggregate.start;
+          window["count"] = aggregate.count;
+          window["min"] = aggregate.min / 16.0f;
+          window["max"] = aggregate.max / 16.0f;
+          window["mean"] = aggregate.mean() / 16.0f;
+        }
+      }
+#endif
+
+    private:
+      // rolling window: the last count readings
+      typedef struct {
+          int32_t sum;
+          uint32_t count;
+          int16_t min;
+          int16_t max;
+          // an expired reading was the min or the max: rescan on the next aggregate
+          bool dirty;
+      } Window;
+
+      Sample _samples[N];
+      // readings added since the last clear(): the reading i is stored at i % N
+      uint32_t _total = 0;
+      size_t _count = 0;
+      uint32_t _windows[MYCILA_DS18_HISTORY_WINDOWS] = {};
+      mutable Window _rolling[MYCILA_DS18_HISTORY_WINDOWS] = {};
+      mutable std::mutex _mutex;
+
+      const Sample& _sample(uint32_t i) const { return _samples[i % N]; }
+
+      // remove the oldest reading of a window
+      void _expire(Window& window) {
+        const int16_t raw = _sample(_total - window.count).raw;
+        window.sum -= raw;
+        window.count--;
+        if (raw == window.min || raw == window.max)
+          window.dirty = true;
+      }
+
+      Aggregate _aggregate(size_t index) const {
+        Window& window = _rolling[index];
+        if (!window.count)
+          return Aggregate{};
+        if (window.dirty) {
+          window.min = window.max = _sample(_total - 1).raw;
+          for (uint32_t i = 1; i <= window.count; i++) {
+            const int16_t raw = _sample(_total - i).raw;
+            if (raw < window.min)
+              window.min = raw;
+            if (raw > window.max)
+              window.max = raw;
+          }
+          window.dirty = false;
+        }
+        return {_sample(_total - window.count).time, window.min, window.max, window.sum, window.count};
+      }
+  };
+} // namespace Mycila
@@ -0,0 +1,238 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) Mathieu Carbou
+ */
+#pragma once
+
+#include "MycilaDS18.h"
+
+#include <algorithm>
+#include <mutex>
+#include <optional>
+
+namespace Mycila {
+  // callback signature for registry reads: called for each successful read, with the temperature in 1/16 °C
+  typedef void (*DS18RegistryCallback)(size_t index, uint64_t address, int16_t raw, void* arg);
+
+  // Compact table of up to N sensors on one bus, for boards with hundreds of sensors.
+  // Unlike DS18 objects, sensors have no mutex, callback or OneWire32 instance of their own:
+  // addresses, readings, timestamps and results are kept in contiguous arrays sized at compile time,
+  // behind a single lock, and nothing is allocated on the heap after begin().
+  // Conversions are broadcast like DS18Bus. Combined with a OneWire32 created with a static buffer,
+  // the RAM usage is fully predictable:
+  //
+  //   static rmt_symbol_word_t buffer[DS18_MAX_BLOCKS];
+  //   static OneWire32 oneWire(18, buffer);
+  //   static Mycila::DS18Registry<128> registry;
+  template <size_t N>
+  class DS18Registry {
+      static_assert(N <= UINT16_MAX, "sensor indexes are stored on 16 bits");
+
+    public:
+      ~DS18Registry() { end(); }
+
+      // Use an existing OneWire32 instance, routed to the pin before each access
+      void begin(OneWire32* oneWire, const int8_t pin) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_oneWire)
+          return;
+        _oneWire = oneWire;
+        _pin = (gpio_num_t)pin;
+        _request();
+      }
+      void begin(OneWire32* oneWire) { begin(oneWire, oneWire->pin()); }
+
+      void end() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _oneWire = nullptr;
+        _pin = GPIO_NUM_NC;
+        _count = 0;
+      }
+
+      // Register a sensor: returns its index, or -1 if the registry is full
+      int add(uint64_t address) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        for (size_t i = 0; i < _count; i++)
+          if (_addresses[i] == address)
+            return static_cast<int>(i);
+        if (_count >= N)
+          return -1;
+        _addresses[_count] = address;
+        _raw[_count] = 0;
+        _times[_count] = 0;
+        _results[_count] = OneWire32::Result::OK;
+        _conversionTime = MYCILA_DS18_CONVERSION_TIME_MS;
+        return static_cast<int>(_count++);
+      }
+
+      bool remove(uint64_t address) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        for (size_t i = 0; i < _count; i++) {
+          if (_addresses[i] == address) {
+            for (size_t j = i + 1; j < _count; j++) {
+              _addresses[j - 1] = _addresses[j];
+              _raw[j - 1] = _raw[j];
+              _times[j - 1] = _times[j];
+              _results[j - 1] = _results[j];
+            }
+            _count--;
+            return true;
+          }
+        }
+        return false;
+      }
+
+      // Search the bus for DS18 sensors (other devices are skipped) and register them: returns the number of sensors registered
+      size_t discover() {
+        static const uint8_t families[] = {MYCILA_DS18_DS18B20, MYCILA_DS18_DS1822, MYCILA_DS18_DS18S20, MYCILA_DS18_DS1825, MYCILA_DS18_DS28EA00};
+        if (!_oneWire)
+          return 0;
+        for (size_t f = 0; f < sizeof(families); f++) {
+          OneWire32::Search search;
+          search.prefix = families[f];
+          search.prefixBits = 8;
+          uint64_t address;
+          for (;;) {
+            bool found;
+            {
+              std::lock_guard<OneWire32> busLock(*_oneWire);
+              found = _oneWire->route(_pin) && _oneWire->next(search, address);
+            }
+            if (!found || add(address) < 0)
+              break;
+          }
+        }
+        return _count;
+      }
+
+      // Read all the sensors (async and non-blocking)
+      // If the broadcast conversion is not yet complete, returns 0.
+      // Otherwise reads all the scratchpads, starts a new broadcast conversion, calls the callback for each successful read
+      // and returns the number of sensors successfully read.
+      // The callback is called without the registry lock: it can use the getters, but must not call read().
+      // Sensors added or removed while the callbacks run may shift the indexes.
+      size_t read() {
+        std::lock_guard<std::mutex> readLock(_readMutex);
+
+        size_t count = 0;
+        DS18RegistryCallback callback;
+        void* callbackArg;
+        {
+          std::lock_guard<std::mutex> lock(_mutex);
+
+          if (!_oneWire || millis() - _requestTime < _conversionTime)
+            return 0;
+
+          // the slowest sensor drives the next broadcast conversion: a DS18S20 always needs the full conversion time
+          uint32_t conversionTime = 0;
+          {
+            std::lock_guard<OneWire32> busLock(*_oneWire);
+            const bool routed = _oneWire->route(_pin);
+            for (size_t i = 0; i < _count; i++) {
+              if ((_addresses[i] & 0xFF) == MYCILA_DS18_DS18S20)
+                conversionTime = MYCILA_DS18_CONVERSION_TIME_MS;
+              uint8_t data[9];
+              OneWire32::Result result = routed ? _oneWire->readScratchpad(_addresses[i], data) : OneWire32::Result::DRIVER;
+              _results[i] = result;
+              if (result != OneWire32::Result::OK)
+                continue;
+              _raw[i] = OneWire32::decoder(_addresses[i])(data);
+              _times[i] = millis();
+              conversionTime = std::max(conversionTime, DS18::getConversionTime(_addresses[i], MYCILA_DS18_MIN_RESOLUTION + ((data[4] >> 5) & 0x03)));
+              _updated[count++] = i;
+            }
+          }
+
+          if (conversionTime)
+            _conversionTime = conversionTime;
+
+          _request();
+          callback = _callback;
+          callbackArg = _callbackArg;
+        }
+
+        if (callback) {
+          for (size_t k = 0; k < count; k++) {
+            const size_t index = _updated[k];
+            uint64_t address;
+            int16_t raw;
+            {
+              std::lock_guard<std::mutex> lock(_mutex);
+              if (index >= _count)
+                continue;
+              address = _addresses[index];
+              raw = _raw[index];
+            }
+            callback(index, address, raw, callbackArg);
+          }
+        }
+        return count;
+      }
+
+      void listen(DS18RegistryCallback callback, void* arg = nullptr) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _callback = callback;
+        _callbackArg = arg;
+      }
+
+      void setExpirationDelay(uint32_t seconds) { _expirationDelay = seconds; }
+      uint32_t getExpirationDelay() const { return _expirationDelay; }
+
+      size_t size() const { return _count; }
+      static constexpr size_t capacity() { return N; }
+      OneWire32* getOneWire() const { return _oneWire; }
+      gpio_num_t getPin() const { return _pin; }
+
+      uint64_t getAddress(size_t index) const { return index < _count ? _addresses[index] : 0; }
+      // Get the last valid reading time, 0 if none
+      uint32_t getLastTime(size_t index) const {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return index < _count ? _times[index] : 0;
+      }
+      // Get the result of the last read attempt
+      OneWire32::Result getResult(size_t index) const {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return index < _count ? static_cast<OneWire32::Result>(_results[index]) : OneWire32::Result::DRIVER;
+      }
+      // Get the temperature in 1/16 °C if the last reading is present and not expired
+      std::optional<int16_t> getRawTemperature(size_t index) const {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (index >= _count || !_times[index] || (_expirationDelay > 0 && millis() - _times[index] >= _expirationDelay * 1000))
+          return std::nullopt;
+        return _raw[index];
+      }
+      std::optional<float> getTemperature(size_t index) const {
+        const std::optional<int16_t> raw = getRawTemperature(index);
+        if (raw.has_value())
+          return raw.value() / 16.0f;
+        return std::nullopt;
+      }
+
+    private:
+      OneWire32* _oneWire = nullptr;
+      gpio_num_t _pin = GPIO_NUM_NC;
+      size_t _count = 0;
+      uint32_t _requestTime = 0;
+      uint32_t _conversionTime = MYCILA_DS18_CONVERSION_TIME_MS;
+      uint32_t _expirationDelay = 0;
+      DS18RegistryCallback _callback = nullptr;
+      void* _callbackArg = nullptr;
+      mutable std::mutex _mutex;
+      // serializes read(), which calls the callbacks without holding _mutex
+      std::mutex _readMutex;
+      uint64_t _addresses[N];
+      int16_t _raw[N];
+      uint32_t _times[N];
+      uint8_t _results[N];
+      // indexes of the successful reads of the last read(), passed to the callback
+      uint16_t _updated[N];
+
+      // start a new broadcast conversion: must be called with _mutex held
+      void _request() {
+        std::lock_guard<OneWire32> busLock(*_oneWire);
+        if (_oneWire->route(_pin))
+          _oneWire->request();
+        _requestTime = millis();
+      }
+  };
+} // namespace Mycila
@@ -4,7 +4,11 @@ https://github.com/junkfix/esp32-ds18b20
 
 #include "OneWireESP32.h"
 
+#include "driver/gpio.h"
+
 #include <esp_idf_version.h>
+#include <esp_timer.h>
+#include <string.h>
 
 #define OW_RESET_PULSE             500
 #define OW_RESET_WAIT              200
@@ -15,15 +19,17 @@ https://github.com/junkfix/esp32-ds18b20
 #define OW_SLOT_BIT                60
 #define OW_SLOT_RECOVERY           5
 #define OW_TIMEOUT                 50
-
-#if CONFIG_IDF_TARGET_ESP32 || CONFIG_IDF_TARGET_ESP32S2
-  #define DS18_MAX_BLOCKS 64
-#else
-  #define DS18_MAX_BLOCKS 48
-#endif
+#define OW_EEPROM_WRITE            10
+#define OW_SEARCH_RETRIES          3
 
 static constexpr size_t owbuflen = DS18_MAX_BLOCKS * sizeof(rmt_symbol_word_t);
 
+// bytes read per RMT receive: 8 symbols per byte, keeping one symbol spare for the end marker
+static constexpr uint8_t owreadchunk = (DS18_MAX_BLOCKS - 1) / 8;
+
+static const uint8_t ow_ones[8] = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
+static_assert(owreadchunk <= sizeof(ow_ones), "read chunk larger than read slot buffer");
+
 static rmt_symbol_word_t ow_bit0 = {
   .duration0 = OW_SLOT_START + OW_SLOT_BIT,
   .level0 = 0,
@@ -50,14 +56,44 @@ const rmt_receive_config_t owrxconf = {
 #endif
 };
 
-IRAM_ATTR static bool owrxdone(rmt_channel_handle_t ch, const rmt_rx_done_event_data_t* edata, void* udata) {
+// accounts a primitive in the stats: read slots are sent by write(), so nested primitives are only counted once
+struct OneWire32::Meter {
+    OneWire32& ow;
+    const int64_t start;
+    Meter(OneWire32& o, uint32_t transactions, uint32_t slots, uint32_t resets = 0) : ow(o), start(esp_timer_get_time()) {
+      if (!ow.owdepth++) {
+        ow.owstats.transactions += transactions;
+        ow.owstats.slots += slots;
+        ow.owstats.resets += resets;
+      }
+    }
+    ~Meter() {
+      if (!--ow.owdepth) {
+        const uint32_t elapsed = esp_timer_get_time() - start;
+        ow.owstats.time += elapsed;
+        ow.owhealth.latency.add(elapsed);
+      }
+    }
+};
+
+IRAM_ATTR static bool owrxdone(rmt_channel_handle_t /*ch*/, const rmt_rx_done_event_data_t* edata, void* udata) {
   BaseType_t h = pdFALSE;
   xQueueSendFromISR((QueueHandle_t)udata, edata, &h);
   return (h == pdTRUE);
 }
 
-OneWire32::OneWire32(uint8_t pin) {
-  owbuf = new rmt_symbol_word_t[DS18_MAX_BLOCKS];
+// end of a transmission: engages the strong pull-up armed by writePullup() right after the last bit
+IRAM_ATTR bool OneWire32::txdone(rmt_channel_handle_t /*ch*/, const rmt_tx_done_event_data_t* /*edata*/, void* udata) {
+  OneWire32* ow = static_cast<OneWire32*>(udata);
+  if (ow->owspuarm.exchange(false) && ow->owspu != GPIO_NUM_NC) {
+    gpio_set_level(ow->owspu, ow->owspulow ? 0 : 1);
+  }
+  return false;
+}
+
+OneWire32::OneWire32(uint8_t pin, rmt_symbol_word_t* buffer) {
+  owownbuf = buffer == nullptr;
+  owbuf = owownbuf ? new rmt_symbol_word_t[DS18_MAX_BLOCKS] : buffer;
 
   owpin = static_cast<gpio_num_t>(pin);
 
@@ -76,6 +112,21 @@ OneWire32::OneWire32(uint8_t pin) {
     return;
   }
 
+  owqueue = xQueueCreate(1, sizeof(rmt_rx_done_event_data_t));
+  if (owqueue == NULL) {
+    return;
+  }
+
+  drv = open();
+}
+
+OneWire32::OneWire32(OneWireTransport* transport, uint8_t pin) {
+  owpin = static_cast<gpio_num_t>(pin);
+  owio = transport;
+  drv = owio ? 1 : 0;
+}
+
+bool OneWire32::open() {
   rmt_rx_channel_config_t rxconf;
   rxconf.gpio_num = owpin;
   rxconf.clk_src = RMT_CLK_SRC_DEFAULT;
@@ -90,7 +141,7 @@ OneWire32::OneWire32(uint8_t pin) {
 #endif
 
   if (rmt_new_rx_channel(&rxconf, &(owrx)) != ESP_OK) {
-    return;
+    return false;
   }
 
   rmt_tx_channel_config_t txconf;
@@ -109,27 +160,29 @@ OneWire32::OneWire32(uint8_t pin) {
 #endif
 
   if (rmt_new_tx_channel(&txconf, &owtx) != ESP_OK) {
-    return;
-  }
-
-  owqueue = xQueueCreate(1, sizeof(rmt_rx_done_event_data_t));
-  if (owqueue == NULL) {
-    return;
+    return false;
   }
 
   rmt_rx_event_callbacks_t rx_callbacks;
   rx_callbacks.on_recv_done = owrxdone;
 
   if (rmt_rx_register_event_callbacks(owrx, &rx_callbacks, owqueue) != ESP_OK) {
-    return;
+    return false;
+  }
+
+  rmt_tx_event_callbacks_t tx_callbacks;
+  tx_callbacks.on_trans_done = txdone;
+
+  if (rmt_tx_register_event_callbacks(owtx, &tx_callbacks, this) != ESP_OK) {
+    return false;
   }
 
   if (rmt_enable(owrx) != ESP_OK) {
-    return;
+    return false;
   }
 
   if (rmt_enable(owtx) != ESP_OK) {
-    return;
+    return false;
   }
 
   static rmt_symbol_word_t release_symbol;
@@ -140,32 +193,94 @@ OneWire32::OneWire32(uint8_t pin) {
 
   rmt_transmit(owtx, owcenc, &release_symbol, sizeof(rmt_symbol_word_t), &owtxconf);
 
-  drv = 1;
+  return true;
 }
 
-OneWire32::~OneWire32() {
-  if (owbenc) {
-    rmt_del_encoder(owbenc);
-  }
-  if (owcenc) {
-    rmt_del_encoder(owcenc);
-  }
+void OneWire32::close() {
   if (owrx) {
     rmt_disable(owrx);
     rmt_del_channel(owrx);
+    owrx = nullptr;
   }
   if (owtx) {
+    rmt_tx_wait_all_done(owtx, OW_TIMEOUT);
     rmt_disable(owtx);
     rmt_del_channel(owtx);
+    owtx = nullptr;
+  }
+}
+
+bool OneWire32::route(uint8_t pin) {
+  std::lock_guard<std::recursive_mutex> lock(owlock);
+  if (pin == owpin) {
+    return drv;
+  }
+  const int64_t start = esp_timer_get_time();
+  owconv = 0;
+  strongPullup(false);
+  const gpio_num_t previous = owpin;
+  owpin = static_cast<gpio_num_t>(pin);
+  // parasite power configuration of the new pin
+  const Power* p = power(false);
+  owparasite = p && p->parasite;
+  owspu = p ? p->spu : GPIO_NUM_NC;
+  owspulow = p ? p->spulow : true;
+  if (owio) {
+    drv = owio->route(pin) ? 1 : 0;
+    owroute = esp_timer_get_time() - start;
+    return drv;
+  }
+  close();
+  // release the previous bus: input with pull-up, so the line stays idle (high)
+  gpio_reset_pin(previous);
+  drv = (owbenc && owcenc && owqueue && open()) ? 1 : 0;
+  owroute = esp_timer_get_time() - start;
+  return drv;
+}
+
+OneWire32::~OneWire32() {
+  if (owengine) {
+    // dedicated semaphore: task notifications of the calling task may be used by someone else
+    StaticSemaphore_t stopped;
+    owstopper = xSemaphoreCreateBinaryStatic(&stopped);
+    Transaction* stop = nullptr;
+    xQueueSend(owjobs, &stop, portMAX_DELAY);
+    xSemaphoreTake(owstopper, portMAX_DELAY);
+    owstopper = nullptr;
+    owengine = nullptr;
+  }
+  if (owjobs) {
+    vQueueDelete(owjobs);
+  }
+  if (owbenc) {
+    rmt_del_encoder(owbenc);
+  }
+  if (owcenc) {
+    rmt_del_encoder(owcenc);
+  }
+  close();
+  strongPullup(false);
+  for (uint8_t i = 0; i < OW_MAX_PINS; i++) {
+    if (owpower[i].spu != GPIO_NUM_NC) {
+      gpio_reset_pin(owpower[i].spu);
+    }
   }
   if (owqueue) {
     vQueueDelete(owqueue);
   }
   drv = 0;
-  delete[] owbuf;
+  if (owownbuf) {
+    delete[] owbuf;
+  }
 }
 
 bool OneWire32::reset() {
+  owconv = 0;
+  strongPullup(false);
+  Meter meter(*this, 1, 0, 1);
+  if (owio) {
+    return presence(owio->reset());
+  }
 
   rmt_symbol_word_t symbol_reset;
   symbol_reset.duration0 = OW_RESET_PULSE;
@@ -196,10 +311,22 @@ bool OneWire32::reset() {
       found = false;
     }
   }
+  return presence(found);
+}
+
+bool OneWire32::presence(bool found) {
+  owhealth.resets++;
+  if (!found) {
+    owhealth.absent++;
+  }
   return found;
 }
 
 bool OneWire32::read(uint8_t& data, uint8_t len) {
+  Meter meter(*this, (len < 8) ? len : 1, len);
+  if (owio) {
+    return owio->read(data, len);
+  }
 
   rmt_rx_done_event_data_t evt;
   rmt_receive(owrx, owbuf, owbuflen, &owrxconf);
@@ -224,6 +351,10 @@ bool OneWire32::read(uint8_t& data, uint8_t len) {
 }
 
 bool OneWire32::write(const uint8_t data, uint8_t len) {
+  Meter meter(*this, (len < 8) ? len : 1, len);
+  if (owio) {
+    return owio->write(data, len);
+  }
 
   if (len < 8) {
     const rmt_symbol_word_t* sb;
@@ -245,22 +376,235 @@ bool OneWire32::write(const uint8_t data, uint8_t len) {
   return (rmt_tx_wait_all_done(owtx, OW_TIMEOUT) == ESP_OK);
 }
 
-void OneWire32::request() {
-  if (drv && reset()) {
-    write(0xCC);
-    write(0x44);
+bool OneWire32::triplet(int8_t dir, uint8_t& bits) {
+  const uint8_t n = dir < 0 ? 2 : 3;
+  Meter meter(*this, 1, n);
+  if (owio) {
+    uint8_t a, b;
+    if ((dir >= 0 && !owio->write(dir, 1)) || !owio->read(a, 1) || !owio->read(b, 1)) {
+      return false;
+    }
+    bits = (a & 0x01) | ((b & 0x01) << 1);
+    return true;
+  }
+
+  rmt_symbol_word_t symbols[3];
+  uint8_t k = 0;
+  if (dir >= 0) {
+    symbols[k++] = dir ? ow_bit1 : ow_bit0;
+  }
+  symbols[k++] = ow_bit1;
+  symbols[k++] = ow_bit1;
+
+  rmt_rx_done_event_data_t evt;
+  rmt_receive(owrx, owbuf, owbuflen, &owrxconf);
+  if (rmt_transmit(owtx, owcenc, symbols, n * sizeof(rmt_symbol_word_t), &owtxconf) != ESP_OK ||
+      rmt_tx_wait_all_done(owtx, OW_TIMEOUT) != ESP_OK ||
+      xQueueReceive(owqueue, &evt, pdMS_TO_TICKS(OW_TIMEOUT)) != pdTRUE) {
+    return false;
+  }
+
+  // the write slot is received too (loop back): the read slots are the last 2 symbols
+  if (evt.num_symbols < n) {
+    return false;
+  }
+  rmt_symbol_word_t* symbol = evt.received_symbols + (n - 2);
+  bits = 0;
+  for (uint8_t i = 0; i < 2; i++) {
+    if (!(symbol[i].duration0 > OW_SLOT_BIT_SAMPLE_TIME)) {
+      bits |= 1 << i;
+    }
   }
+  return true;
 }
 
-void OneWire32::request(uint64_t& addr) {
-  if (drv && reset()) {
-    write(0x55);
-    uint8_t* a = (uint8_t*)&addr;
-    for (uint8_t i = 0; i < 8; i++) {
-      write(a[i]);
+bool OneWire32::writeBytes(const uint8_t* data, uint8_t len) {
+  Meter meter(*this, 1, len * 8u);
+  if (owio) {
+    return owio->writeBytes(data, len);
+  }
+  if (rmt_transmit(owtx, owbenc, data, len, &owtxconf) != ESP_OK) {
+    return false;
+  }
+  return (rmt_tx_wait_all_done(owtx, OW_TIMEOUT) == ESP_OK);
+}
+
+bool OneWire32::readBytes(uint8_t* data, uint8_t len) {
+  Meter meter(*this, (len + owreadchunk - 1) / owreadchunk, len * 8u);
+  if (owio) {
+    return owio->readBytes(data, len);
+  }
+  memset(data, 0, len);
+  for (uint8_t offset = 0; offset < len; offset += owreadchunk) {
+    const uint8_t n = (len - offset < owreadchunk) ? len - offset : owreadchunk;
+
+    rmt_rx_done_event_data_t evt;
+    rmt_receive(owrx, owbuf, owbuflen, &owrxconf);
+
+    if (!writeBytes(ow_ones, n) || xQueueReceive(owqueue, &evt, pdMS_TO_TICKS(OW_TIMEOUT)) != pdTRUE) {
+      return false;
     }
-    write(0x44);
+
+    size_t symbol_num = evt.num_symbols;
+    rmt_symbol_word_t* symbol = evt.received_symbols;
+    for (size_t i = 0; i < symbol_num && i < n * 8u; i++) {
+      if (!(symbol[i].duration0 > OW_SLOT_BIT_SAMPLE_TIME)) {
+        data[offset + i / 8] |= 1 << (i % 8);
+      }
+    }
+  }
+  return true;
+}
+
+bool OneWire32::writePullup(const uint8_t* data, uint8_t len) {
+  if (!owparasite) {
+    return writeBytes(data, len);
+  }
+  if (owio) {
+    if (!writeBytes(data, len)) {
+      return false;
+    }
+    strongPullup(true);
+    return true;
+  }
+  // the datasheet requires the strong pull-up within 10 us of the last bit: it is engaged by the TX done interrupt,
+  // as this task may only run again after a context switch or a preemption
+  owspuarm = true;
+  const bool ok = writeBytes(data, len);
+  if (!owspuarm.exchange(false)) {
+    owspuon = true;
+  } else if (ok) {
+    // the interrupt did not run
+    strongPullup(true);
+  }
+  return ok;
+}
+
+bool OneWire32::command(uint8_t cmd) {
+  std::lock_guard<std::recursive_mutex> lock(owlock);
+  if (!drv || !reset()) {
+    return false;
+  }
+  const uint8_t frame[2] = {0xCC, cmd};
+  // Convert T and Copy Scratchpad draw their power from the bus
+  return (cmd == 0x44 || cmd == 0x48) ? writePullup(frame, sizeof(frame)) : writeBytes(frame, sizeof(frame));
+}
+
+bool OneWire32::command(const uint64_t& addr, uint8_t cmd) {
+  std::lock_guard<std::recursive_mutex> lock(owlock);
+  if (!drv || !reset()) {
+    return false;
+  }
+  uint8_t frame[10];
+  frame[0] = 0x55;
+  memcpy(frame + 1, &addr, 8);
+  frame[9] = cmd;
+  return (cmd == 0x44 || cmd == 0x48) ? writePullup(frame, sizeof(frame)) : writeBytes(frame, sizeof(frame));
+}
+
+bool OneWire32::readPowerSupply(bool& parasite) {
+  std::lock_guard<std::recursive_mutex> lock(owlock);
+  uint8_t bit;
+  if (!command(0xB4) || !read(bit, 1)) {
+    return false;
+  }
+  // parasite-powered devices pull the line low during the read slot
+  parasite = !bit;
+  return true;
+}
+
+bool OneWire32::readPowerSupply(const uint64_t& addr, bool& parasite) {
+  std::lock_guard<std::recursive_mutex> lock(owlock);
+  uint8_t bit;
+  if (!command(addr, 0xB4) || !read(bit, 1)) {
+    return false;
+  }
+  parasite = !bit;
+  return true;
+}
+
+OneWire32::Power* OneWire32::power(bool create) {
+  Power* free = nullptr;
+  for (uint8_t i = 0; i < OW_MAX_PINS; i++) {
+    if (owpower[i].pin == owpin) {
+      return &owpower[i];
+    }
+    if (!free && owpower[i].pin == GPIO_NUM_NC) {
+      free = &owpower[i];
+    }
+  }
+  if (!create || !free) {
+    return nullptr;
+  }
+  free->pin = owpin;
+  return free;
+}
+
+bool OneWire32::setParasite(bool parasite) {
+  std::lock_guard<std::recursive_mutex> lock(owlock);
+  Power* p = power(parasite);
+  if (p) {
+    p->parasite = parasite;
+  } else if (parasite) {
+    return false;
+  }
+  owparasite = parasite;
+  return true;
+}
+
+bool OneWire32::setStrongPullup(int8_t pin, bool activeLow) {
+  std::lock_guard<std::recursive_mutex> lock(owlock);
+  Power* p = power(pin >= 0);
+  if (!p && pin >= 0) {
+    return false;
+  }
+  strongPullup(false);
+  if (owspu != GPIO_NUM_NC) {
+    gpio_reset_pin(owspu);
+  }
+  owspu = static_cast<gpio_num_t>(pin);
+  owspulow = activeLow;
+  if (p) {
+    p->spu = owspu;
+    p->spulow = owspulow;
+  }
+  if (owspu != GPIO_NUM_NC) {
+    gpio_set_direction(owspu, GPIO_MODE_OUTPUT);
+    gpio_set_level(owspu, owspulow ? 1 : 0);
+  }
+  return true;
+}
+
+void OneWire32::strongPullup(bool on) {
+  if (on == owspuon) {
+    return;
+  }
+  owspuon = on;
+  if (owspu != GPIO_NUM_NC) {
+    gpio_set_level(owspu, on == owspulow ? 0 : 1);
+  }
+}
+
+void OneWire32::request() {
+  std::lock_guard<std::recursive_mutex> lock(owlock);
+  owconv = command(0x44);
+}
+
+void OneWire32::request(uint64_t& addr) {
+  std::lock_guard<std::recursive_mutex> lock(owlock);
+  owconv = command(addr, 0x44);
+}
+
+bool OneWire32::poll(bool& done) {
+  std::lock_guard<std::recursive_mutex> lock(owlock);
+  uint8_t bit;
+  // parasite-powered devices cannot answer while converting, and a read slot would short the strong pull-up
+  if (!drv || !owconv || owparasite || !read(bit, 1)) {
+    return false;
   }
+  // sensors hold the line low during the read slot until the conversion is complete
+  done = bit;
+  return true;
 }
 
 // clang-format off
@@ -284,26 +628,10 @@ const uint8_t crc_table[] = {
 };
 // clang-format on
 
-OneWire32::Result OneWire32::getTemp(uint64_t& addr, float& temp) {
-  if (!drv) {
-    return Result::DRIVER;
-  }
-  if (!reset()) {
-    return Result::TIMEOUT;
-  }
-  write(0x55);
-  uint8_t* a = (uint8_t*)&addr;
-  for (uint8_t i = 0; i < 8; i++) {
-    write(a[i]);
-  }
-  write(0xBE); // Read
-  uint8_t data[9];
+OneWire32::Result OneWire32::checkScratchpad(const uint8_t* data) {
   uint16_t zero = 0;
   uint8_t crc = 0;
   for (uint8_t j = 0; j < 9; j++) {
-    if (!read(data[j], 8)) {
-      data[j] = 0;
-    }
     zero += data[j];
     if (j < 8) {
       crc = crc_table[crc ^ data[j]];
@@ -315,62 +643,349 @@ OneWire32::Result OneWire32::getTemp(uint64_t& addr, float& temp) {
   if (data[8] != crc) {
     return Result::CRC;
   }
+  return Result::OK;
+}
+
+float OneWire32::decodeTemp(const uint64_t& addr, const uint8_t* data) {
+  return ((float)decoder(addr)(data) / 16.0);
+}
+
+OneWire32::Decoder OneWire32::decoder(const uint64_t& addr) {
+  return (addr & 0xFF) == 0x10 ? decode10 : decode12;
+}
+
+int16_t OneWire32::decode12(const uint8_t* data) {
+  int16_t t = (data[1] << 8) | data[0];
+  // bits below the configured resolution are undefined
+  uint8_t res = (data[4] >> 5) & 0x03;
+  return t & ~((1 << (3 - res)) - 1);
+}
+
+int16_t OneWire32::decode10(const uint8_t* data) {
+  // 0.5 °C units
   int16_t t = (data[1] << 8) | data[0];
-  temp = ((float)t / 16.0);
+  const uint8_t remain = data[6];
+  const uint8_t perc = data[7];
+  if (!perc || remain > perc) {
+    return t * 8;
+  }
+  // T = TEMP_READ - 0.25 + (COUNT_PER_C - COUNT_REMAIN) / COUNT_PER_C
+  return (t & ~1) * 8 - 4 + (16 * (perc - remain)) / perc;
+}
+
+OneWire32::Result OneWire32::readScratchpad(const uint64_t& addr, uint8_t* data) {
+  if (!drv) {
+    return Result::DRIVER;
+  }
+  std::lock_guard<std::recursive_mutex> lock(owlock);
+  if (!command(addr, 0xBE)) { // Read
+    return Result::TIMEOUT;
+  }
+  if (!readBytes(data, 9)) {
+    return Result::TIMEOUT;
+  }
+  return checkScratchpad(data);
+}
+
+bool OneWire32::writeScratchpad(const uint64_t& addr, const uint8_t* data, uint8_t len) {
+  std::lock_guard<std::recursive_mutex> lock(owlock);
+  return command(addr, 0x4E) && writeBytes(data, len);
+}
+
+bool OneWire32::copyScratchpad(const uint64_t& addr) {
+  std::lock_guard<std::recursive_mutex> lock(owlock);
+  if (!command(addr, 0x48)) {
+    return false;
+  }
+  // EEPROM write time
+  vTaskDelay(pdMS_TO_TICKS(OW_EEPROM_WRITE));
+  strongPullup(false);
+  return true;
+}
+
+OneWire32::Result OneWire32::getTemp(uint64_t& addr, float& temp) {
+  uint8_t data[9];
+  Result result = readScratchpad(addr, data);
+  if (result != Result::OK) {
+    return result;
+  }
+  temp = decodeTemp(addr, data);
   return Result::OK;
 }
 
-uint8_t OneWire32::search(uint64_t* addresses, uint8_t total) {
-  int8_t last_src;
-  int8_t last_dev = -1;
-  uint8_t found = 0;
-  uint8_t loop = 1;
+OneWire32::Result OneWire32::getTempFast(const uint64_t& addr, int16_t& raw, uint8_t resolution) {
   if (!drv) {
-    return found;
-  }
-  uint64_t addr = 0;
-  while (loop && found < total) {
-    loop = 0;
-    last_src = last_dev;
-    if (!reset()) {
-      found = 0;
-      break;
+    return Result::DRIVER;
+  }
+  std::lock_guard<std::recursive_mutex> lock(owlock);
+  // DS18S20: read up to COUNT_PER_C to decode the same extended resolution as a full read
+  const bool family10 = (addr & 0xFF) == 0x10;
+  uint8_t data[8];
+  if (!command(addr, 0xBE) || !readBytes(data, family10 ? 8 : 2)) {
+    return Result::TIMEOUT;
+  }
+  // abort the scratchpad read
+  reset();
+  int16_t t = (data[1] << 8) | data[0];
+  if (t == -1 || t == (family10 ? 0x00AA : 0x0550)) {
+    return Result::BAD_DATA;
+  }
+  if (family10) {
+    t = decode10(data);
+  } else if (resolution >= 9 && resolution <= 12) {
+    t &= ~((1 << (12 - resolution)) - 1);
+  }
+  raw = t;
+  return Result::OK;
+}
+
+OneWire32::Result OneWire32::searchPass(Search& state, uint64_t& addr) {
+  if (!reset()) {
+    return Result::TIMEOUT;
+  }
+  write(state.cmd, 8);
+  uint64_t rom = state.rom;
+  int8_t last_zero = -1;
+  // direction of the previous bit, sent with the read slots of the next one
+  int8_t pending = -1;
+  for (uint8_t i = 0; i < 64; i += 1) {
+    uint8_t bits, bitA, bitB, dir;
+    uint64_t m = 1ULL << i;
+    if (!triplet(pending, bits)) {
+      return Result::CRC;
     }
-    write(0xF0, 8);
-    for (uint8_t i = 0; i < 64; i += 1) {
-      uint8_t bitA, bitB;
-      uint64_t m = 1ULL << i;
-      if (!read(bitA, 1) || !read(bitB, 1) || (bitA && bitB)) {
-        addr = found = loop = 0;
-        break;
-      } else if (!bitA && !bitB) {
-        if (i == last_src) {
-          write(1, 1);
-          addr |= m;
-        } else {
-          if ((addr & m) == 0 || i > last_src) {
-            write(0, 1);
-            loop = 1;
-            addr &= ~m;
-            last_dev = i;
-          } else {
-            write(1, 1);
-          }
-        }
+    bitA = bits & 0x01;
+    bitB = bits >> 1;
+    if (bitA && bitB) {
+      // nobody answered the first bit: no device matches the search (i.e. no device in alarm)
+      return (i == 0 && !state.rom) ? Result::TIMEOUT : Result::CRC;
+    } else if (i < state.prefixBits) {
+      // targeted search: the prefix branch is forced and the other branches are never visited
+      dir = (state.prefix & m) ? 1 : 0;
+      if ((bitA || bitB) && bitA != dir) {
+        // no device on the prefix branch
+        return state.rom ? Result::CRC : Result::TIMEOUT;
+      }
+    } else if (!bitA && !bitB) {
+      // discrepancy: take the same branch as the previous pass before the last discrepancy,
+      // the 1 branch at the last discrepancy and the 0 branch after
+      if (i < state.last) {
+        dir = (rom & m) ? 1 : 0;
       } else {
-        if (bitA) {
-          write(1, 1);
-          addr |= m;
-        } else {
-          write(0, 1);
-          addr &= ~m;
-        }
+        dir = (i == state.last) ? 1 : 0;
       }
+      if (!dir) {
+        last_zero = i;
+      }
+    } else {
+      dir = bitA;
+    }
+    pending = dir;
+    if (dir) {
+      rom |= m;
+    } else {
+      rom &= ~m;
+    }
+  }
+  if (!write(pending, 1)) {
+    return Result::CRC;
+  }
+  uint8_t crc = 0;
+  const uint8_t* r = (const uint8_t*)&rom;
+  for (uint8_t j = 0; j < 7; j++) {
+    crc = crc_table[crc ^ r[j]];
+  }
+  if (!rom || crc != r[7]) {
+    return Result::CRC;
+  }
+  state.rom = rom;
+  state.last = last_zero;
+  state.done = last_zero < 0;
+  addr = rom;
+  return Result::OK;
+}
+
+bool OneWire32::next(Search& state, uint64_t& addr) {
+  if (!drv || state.done || state.failed) {
+    return false;
+  }
+  std::lock_guard<std::recursive_mutex> lock(owlock);
+  // a failed pass leaves the state unchanged: only the current branch is retried
+  for (uint8_t i = 0; i < OW_SEARCH_RETRIES; i++) {
+    Result result = searchPass(state, addr);
+    if (result == Result::OK) {
+      return true;
     }
-    if (addr) {
-      addresses[found] = addr;
-      found++;
+    if (result == Result::TIMEOUT && !state.rom) {
+      // no presence pulse or no device answering the search
+      state.done = true;
+      return false;
     }
   }
+  state.failed = true;
+  return false;
+}
+
+uint8_t OneWire32::search(uint64_t* addresses, uint8_t total, uint8_t family) {
+  Search state;
+  if (family) {
+    state.prefix = family;
+    state.prefixBits = 8;
+  }
+  uint8_t found = 0;
+  uint64_t addr;
+  while (found < total && next(state, addr)) {
+    addresses[found++] = addr;
+  }
   return found;
 }
+
+bool OneWire32::diff(const uint64_t* known, uint8_t count, DiffCallback callback, void* arg) {
+  uint8_t seen[32] = {0};
+  Search state;
+  uint64_t addr;
+  std::lock_guard<std::recursive_mutex> lock(owlock);
+  while (next(state, addr)) {
+    bool found = false;
+    for (uint8_t i = 0; i < count; i++) {
+      if (known[i] == addr) {
+        seen[i / 8] |= 1 << (i % 8);
+        found = true;
+        break;
+      }
+    }
+    if (!found) {
+      callback(addr, true, arg);
+    }
+  }
+  // only report removals after a complete enumeration
+  if (state.failed) {
+    return false;
+  }
+  for (uint8_t i = 0; i < count; i++) {
+    if (!(seen[i / 8] & (1 << (i % 8)))) {
+      callback(known[i], false, arg);
+    }
+  }
+  return true;
+}
+
+bool OneWire32::submit(Transaction& tx) {
+  if (!drv || tx.busy || tx.overflow) {
+    return false;
+  }
+  if (!owengine) {
+    std::lock_guard<std::recursive_mutex> lock(owlock);
+    if (!owengine) {
+      owjobs = xQueueCreate(OW_ENGINE_QUEUE_SIZE, sizeof(Transaction*));
+      if (owjobs == NULL) {
+        return false;
+      }
+      if (xTaskCreate(engine, "ow_engine", OW_ENGINE_STACK_SIZE, this, OW_ENGINE_PRIORITY, &owengine) != pdPASS) {
+        vQueueDelete(owjobs);
+        owjobs = nullptr;
+        owengine = nullptr;
+        return false;
+      }
+    }
+  }
+  Transaction* job = &tx;
+  tx.busy = true;
+  if (xQueueSend(owjobs, &job, 0) != pdTRUE) {
+    tx.busy = false;
+    return false;
+  }
+  return true;
+}
+
+bool OneWire32::wait(Transaction& tx, TickType_t timeout) {
+  StaticSemaphore_t buffer;
+  SemaphoreHandle_t done = xSemaphoreCreateBinaryStatic(&buffer);
+  {
+    std::lock_guard<std::mutex> lock(owwait);
+    if (!tx.busy) {
+      return true;
+    }
+    tx.waiter = done;
+  }
+  if (xSemaphoreTake(done, timeout) == pdTRUE) {
+    return true;
+  }
+  {
+    std::lock_guard<std::mutex> lock(owwait);
+    if (tx.waiter == done) {
+      tx.waiter = nullptr;
+      return false;
+    }
+  }
+  // completed meanwhile: the engine is about to give the semaphore, which lives on this stack
+  xSemaphoreTake(done, portMAX_DELAY);
+  return true;
+}
+
+void OneWire32::engine(void* arg) {
+  OneWire32* ow = static_cast<OneWire32*>(arg);
+  Transaction* tx;
+  for (;;) {
+    // worker task: blocks in xQueueReceive() until a transaction is queued, then runs it with blocking calls
+    // (rmt_tx_wait_all_done() and xQueueReceive() on the RX done queue), so the bus time is spent in this task, not the caller's
+    if (xQueueReceive(ow->owjobs, &tx, portMAX_DELAY) != pdTRUE) {
+      continue;
+    }
+    if (tx == nullptr) {
+      break;
+    }
+    ow->execute(*tx);
+    // the transaction is only released once its callback has returned
+    if (tx->cb) {
+      tx->cb(*tx, tx->cbarg);
+    }
+    SemaphoreHandle_t waiter;
+    {
+      std::lock_guard<std::mutex> lock(ow->owwait);
+      waiter = tx->waiter;
+      tx->waiter = nullptr;
+      tx->busy.store(false, std::memory_order_release);
+    }
+    // the transaction may be destroyed from now on: only the waiter semaphore is used
+    if (waiter) {
+      xSemaphoreGive(waiter);
+    }
+  }
+  xSemaphoreGive(ow->owstopper);
+  vTaskDelete(NULL);
+}
+
+void OneWire32::execute(Transaction& tx) {
+  std::lock_guard<std::recursive_mutex> lock(owlock);
+  tx.res = Result::OK;
+  if (!drv) {
+    tx.res = Result::DRIVER;
+    return;
+  }
+  for (uint8_t i = 0; i < tx.count; i++) {
+    const Transaction::Step& step = tx.steps[i];
+    bool ok = false;
+    switch (step.op) {
+      case Transaction::Op::RESET:
+        ok = reset();
+        break;
+      case Transaction::Op::WRITE:
+        ok = writeBytes(step.out, step.len);
+        break;
+      case Transaction::Op::WRITE_PULLUP:
+        ok = writePullup(step.out, step.len);
+        break;
+      case Transaction::Op::READ:
+        ok = readBytes(step.in, step.len);
+        break;
+      case Transaction::Op::ROUTE:
+        ok = route(step.len);
+        break;
+    }
+    if (!ok) {
+      tx.res = Result::TIMEOUT;
+      return;
+    }
+  }
+}
@@ -8,20 +8,38 @@ https://github.com/junkfix/esp32-ds18b20
 #include "driver/rmt_tx.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/queue.h"
+#include "freertos/semphr.h"
 #include "freertos/task.h"
 #include "sdkconfig.h"
 
-class OneWire32 {
-  private:
-    gpio_num_t owpin;
-    rmt_channel_handle_t owtx;
-    rmt_channel_handle_t owrx;
-    rmt_encoder_handle_t owcenc;
-    rmt_encoder_handle_t owbenc;
-    rmt_symbol_word_t* owbuf;
-    QueueHandle_t owqueue;
-    uint8_t drv = 0;
+#include "OneWireTransport.h"
 
+#include <atomic>
+#include <mutex>
+
+#ifndef OW_ENGINE_STACK_SIZE
+  #define OW_ENGINE_STACK_SIZE 4096
+#endif
+#ifndef OW_ENGINE_PRIORITY
+  #define OW_ENGINE_PRIORITY 1
+#endif
+#ifndef OW_ENGINE_QUEUE_SIZE
+  #define OW_ENGINE_QUEUE_SIZE 8
+#endif
+#define OW_MAX_STEPS 5
+// pins with their own parasite power configuration on a routed instance (see route())
+#ifndef OW_MAX_PINS
+  #define OW_MAX_PINS 8
+#endif
+
+// RMT symbols per channel, which is also the size of the receive buffer
+#if CONFIG_IDF_TARGET_ESP32 || CONFIG_IDF_TARGET_ESP32S2
+  #define DS18_MAX_BLOCKS 64
+#else
+  #define DS18_MAX_BLOCKS 48
+#endif
+
+class OneWire32 {
   public:
     enum Result {
       OK = 0,
@@ -31,14 +49,265 @@ class OneWire32 {
       DRIVER = 4
     };
 
-    OneWire32(uint8_t pin);
+    // state of an incremental ROM search, which can be resumed at any time (see next())
+    struct Search {
+        // last address found
+        uint64_t rom = 0;
+        // bit position of the last discrepancy where the 0 branch was taken, -1 if none
+        int8_t last = -1;
+        // search command: 0xF0 (Search ROM) or 0xEC (Alarm Search: only devices with an alarm flag set)
+        uint8_t cmd = 0xF0;
+        // targeted search: only the devices whose first prefixBits ROM bits match prefix (i.e. 8 bits for a family code)
+        uint64_t prefix = 0;
+        uint8_t prefixBits = 0;
+        // all the devices were enumerated
+        bool done = false;
+        // a pass failed after all retries
+        bool failed = false;
+    };
+
+    // fixed-bucket latency histogram: counts[i] counts the durations below bounds[i] microseconds,
+    // the last bucket counts the longer ones
+    struct Histogram {
+        static constexpr uint8_t size = 10;
+        static constexpr uint32_t bounds[size - 1] = {250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000};
+        uint32_t counts[size] = {};
+        void add(uint32_t us) {
+          uint8_t i = 0;
+          while (i < size - 1 && us >= bounds[i]) {
+            i++;
+          }
+          counts[i]++;
+        }
+    };
+
+    // always-on bus health counters (see health())
+    struct Health {
+        // reset pulses
+        uint32_t resets = 0;
+        // reset pulses without presence pulse
+        uint32_t absent = 0;
+        // duration of each RMT transaction (or transport call)
+        Histogram latency;
+    };
+
+    // decode the temperature of a valid scratchpad in 1/16 °C
+    typedef int16_t (*Decoder)(const uint8_t* data);
+
+    typedef void (*DiffCallback)(uint64_t addr, bool added, void* arg);
+
+    // bus usage accumulated by the primitives (see stats())
+    struct Stats {
+        // RMT transmissions (or transport calls)
+        uint32_t transactions = 0;
+        // reset pulses
+        uint32_t resets = 0;
+        // read and write bit slots
+        uint32_t slots = 0;
+        // time spent on the bus in microseconds
+        uint64_t time = 0;
+    };
+
+    // sequence of reset / write / read steps executed asynchronously by the bus engine task
+    class Transaction {
+      public:
+        typedef void (*Callback)(Transaction& tx, void* arg);
+
+        // steps are executed in order: data buffers must stay valid until completion
+        Transaction& clear() {
+          count = 0;
+          overflow = false;
+          return *this;
+        }
+        Transaction& reset() { return add(Op::RESET, 0, nullptr, nullptr); }
+        // pullup: engage the strong pull-up after the last bit on a parasite-powered bus (Convert T, Copy Scratchpad)
+        Transaction& write(const uint8_t* data, uint8_t len, bool pullup = false) { return add(pullup ? Op::WRITE_PULLUP : Op::WRITE, len, data, nullptr); }
+        Transaction& read(uint8_t* data, uint8_t len) { return add(Op::READ, len, nullptr, data); }
+        // re-route the RMT channels to another pin (see OneWire32::route())
+        Transaction& route(uint8_t pin) { return add(Op::ROUTE, pin, nullptr, nullptr); }
+
+        // called from the engine task when the transaction is complete, before pending() becomes false and wait() returns
+        void onComplete(Callback callback, void* arg = nullptr) {
+          cb = callback;
+          cbarg = arg;
+        }
+
+        bool pending() const { return busy; }
+        Result result() const { return res; }
+
+      private:
+        friend class OneWire32;
+        enum class Op : uint8_t {
+          RESET,
+          WRITE,
+          // write, then engage the strong pull-up
+          WRITE_PULLUP,
+          READ,
+          // len is the pin
+          ROUTE
+        };
+        struct Step {
+            Op op;
+            uint8_t len;
+            const uint8_t* out;
+            uint8_t* in;
+        };
+        Step steps[OW_MAX_STEPS];
+        uint8_t count = 0;
+        // more than OW_MAX_STEPS steps were added: submit() rejects the transaction
+        bool overflow = false;
+        Result res = Result::OK;
+        Callback cb = nullptr;
+        void* cbarg = nullptr;
+        std::atomic<bool> busy{false};
+        // semaphore of the task in wait(), guarded by owwait
+        SemaphoreHandle_t waiter = nullptr;
+
+        Transaction& add(Op op, uint8_t len, const uint8_t* out, uint8_t* in) {
+          if (count < OW_MAX_STEPS) {
+            steps[count++] = {op, len, out, in};
+          } else {
+            overflow = true;
+          }
+          return *this;
+        }
+    };
+
+    // buffer: receive buffer of DS18_MAX_BLOCKS symbols to avoid a heap allocation (i.e. static), allocated if null
+    OneWire32(uint8_t pin, rmt_symbol_word_t* buffer = nullptr);
+    // use a custom transport instead of the RMT peripheral: the transport must outlive this instance
+    OneWire32(OneWireTransport* transport, uint8_t pin = 0);
     ~OneWire32();
+    OneWireTransport* transport() const { return owio; }
     gpio_num_t pin() const { return owpin; }
+    // re-route the RMT channel pair to another pin, so that several buses can share the same channels:
+    // the previous pin is released (input with pull-up) and the channels are re-created on the new pin
+    bool route(uint8_t pin);
+    // duration of the last route() in microseconds
+    uint32_t routeTime() const { return owroute; }
+    // bus lock (recursive): hold it to chain several operations without interleaving from other tasks
+    void lock() { owlock.lock(); }
+    void unlock() { owlock.unlock(); }
+    // queue a transaction for the engine task, which is started on first use
+    // returns false if the transaction is pending or has more than OW_MAX_STEPS steps
+    bool submit(Transaction& tx);
+    // wait for a submitted transaction and its callback to complete (one waiting task per transaction):
+    // the transaction can then be destroyed
+    bool wait(Transaction& tx, TickType_t timeout = portMAX_DELAY);
+    // reset pulse: also releases the strong pull-up
     bool reset();
+    // Read Power Supply: parasite is true if any device (or the addressed one) is parasite-powered
+    bool readPowerSupply(bool& parasite);
+    bool readPowerSupply(const uint64_t& addr, bool& parasite);
+    // parasite-powered bus: the strong pull-up is engaged after Convert T and Copy Scratchpad,
+    // and conversions cannot be polled (poll() returns false)
+    // Applies to the current pin only: each routed pin keeps its own configuration (up to OW_MAX_PINS pins).
+    // Returns false if too many pins are configured.
+    bool setParasite(bool parasite);
+    bool isParasite() const { return owparasite; }
+    // GPIO driving the strong pull-up of the current pin (i.e. a P-MOSFET between VCC and the bus), -1 for none
+    bool setStrongPullup(int8_t pin, bool activeLow = true);
+    // engage or release the strong pull-up: the bus must not be used while it is engaged
+    void strongPullup(bool on);
     void request();
     void request(uint64_t& addr);
+    // poll the conversion started by the last request() with a single read slot
+    // returns false if the bus was used since then and cannot be polled anymore
+    bool poll(bool& done);
     Result getTemp(uint64_t& addr, float& temp);
-    uint8_t search(uint64_t* addresses, uint8_t total);
+    // read only the 2 temperature bytes (1/16 °C) and abort the scratchpad read with a reset: no CRC check,
+    // only all-ones (no answer) and the 85 °C power-on value are rejected (BAD_DATA)
+    // DS18S20: the first 8 bytes are read, so that the temperature is decoded like a full read (see decode10())
+    Result getTempFast(const uint64_t& addr, int16_t& raw, uint8_t resolution = 12);
+    // read the 9 bytes of the scratchpad and check the CRC
+    Result readScratchpad(const uint64_t& addr, uint8_t* data);
+    // write TH, TL and configuration register (DS18S20 only has TH and TL)
+    bool writeScratchpad(const uint64_t& addr, const uint8_t* data, uint8_t len);
+    // copy TH, TL and configuration register to EEPROM
+    bool copyScratchpad(const uint64_t& addr);
+    // find up to total devices, only of the given family code if not 0
+    uint8_t search(uint64_t* addresses, uint8_t total, uint8_t family = 0);
+    // find the next device of an incremental search: a failing pass is retried without restarting the search
+    // returns false when the search is done or failed
+    bool next(Search& state, uint64_t& addr);
+    // enumerate the bus and compare with known addresses (max 255): reports added devices as they are found,
+    // and removed devices once the enumeration is complete. Returns false if the enumeration failed.
+    bool diff(const uint64_t* known, uint8_t count, DiffCallback callback, void* arg = nullptr);
     bool read(uint8_t& data, uint8_t len = 8);
     bool write(const uint8_t data, uint8_t len = 8);
+    // ROM search step in a single RMT transaction: write the direction of the previous bit (if dir >= 0),
+    // then read the bit and its complement (bits: bit 0 = bit, bit 1 = complement)
+    bool triplet(int8_t dir, uint8_t& bits);
+    // send several bytes in a single RMT transaction
+    bool writeBytes(const uint8_t* data, uint8_t len);
+    // read several bytes with as few RMT receives as the RX memory allows
+    bool readBytes(uint8_t* data, uint8_t len);
+    // reset + SKIP ROM + cmd
+    bool command(uint8_t cmd);
+    // reset + MATCH ROM + address + cmd
+    bool command(const uint64_t& addr, uint8_t cmd);
+    // bus usage since creation or the last clearStats(): take a copy under the bus lock to measure an operation
+    Stats stats() const { return owstats; }
+    void clearStats() { owstats = Stats(); }
+    // bus health since creation or the last clearHealth(): never cleared by clearStats()
+    const Health& health() const { return owhealth; }
+    void clearHealth() { owhealth = Health(); }
+    // check the 9 bytes of a scratchpad
+    static Result checkScratchpad(const uint8_t* data);
+    // decode the temperature of a valid scratchpad
+    static float decodeTemp(const uint64_t& addr, const uint8_t* data);
+    // decoder of a family code, to be chosen once per device
+    static Decoder decoder(const uint64_t& addr);
+    // DS18B20, DS1822, DS1825, DS28EA00: bits below the configured resolution are cleared
+    static int16_t decode12(const uint8_t* data);
+    // DS18S20: extended resolution from COUNT_REMAIN and COUNT_PER_C
+    static int16_t decode10(const uint8_t* data);
+
+  private:
+    gpio_num_t owpin;
+    rmt_channel_handle_t owtx = nullptr;
+    rmt_channel_handle_t owrx = nullptr;
+    rmt_encoder_handle_t owcenc = nullptr;
+    rmt_encoder_handle_t owbenc = nullptr;
+    rmt_symbol_word_t* owbuf = nullptr;
+    OneWireTransport* owio = nullptr;
+    bool owownbuf = false;
+    QueueHandle_t owqueue = nullptr;
+    QueueHandle_t owjobs = nullptr;
+    TaskHandle_t owengine = nullptr;
+    SemaphoreHandle_t owstopper = nullptr;
+    std::mutex owwait;
+    std::recursive_mutex owlock;
+    uint8_t drv = 0;
+    uint8_t owconv = 0;
+    uint32_t owroute = 0;
+    gpio_num_t owspu = GPIO_NUM_NC;
+    bool owspulow = true;
+    bool owspuon = false;
+    // strong pull-up to engage at the end of the current transmission (see txdone())
+    std::atomic<bool> owspuarm{false};
+    bool owparasite = false;
+    // parasite power configuration of the pins, restored by route()
+    struct Power {
+        gpio_num_t pin = GPIO_NUM_NC;
+        gpio_num_t spu = GPIO_NUM_NC;
+        bool spulow = true;
+        bool parasite = false;
+    };
+    Power owpower[OW_MAX_PINS];
+    Stats owstats;
+    Health owhealth;
+    uint8_t owdepth = 0;
+
+    struct Meter;
+    bool open();
+    void close();
+    Result searchPass(Search& state, uint64_t& addr);
+    bool presence(bool found);
+    Power* power(bool create);
+    // writeBytes() followed by the strong pull-up on a parasite-powered bus
+    bool writePullup(const uint8_t* data, uint8_t len);
+    static bool txdone(rmt_channel_handle_t ch, const rmt_tx_done_event_data_t* edata, void* udata);
+    static void engine(void* arg);
+    void execute(Transaction& tx);
 };
@@ -0,0 +1,23 @@
+/*
+https://github.com/junkfix/esp32-ds18b20
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+// low level bus access used by OneWire32 instead of the RMT peripheral (i.e. a bus simulator or a recorder)
+class OneWireTransport {
+  public:
+    virtual ~OneWireTransport() = default;
+    // reset pulse: returns true if a presence pulse was detected
+    virtual bool reset() = 0;
+    // read len (1 to 8) bits, LSB first
+    virtual bool read(uint8_t& data, uint8_t len) = 0;
+    // write len (1 to 8) bits, LSB first
+    virtual bool write(const uint8_t data, uint8_t len) = 0;
+    virtual bool writeBytes(const uint8_t* data, uint8_t len) = 0;
+    virtual bool readBytes(uint8_t* data, uint8_t len) = 0;
+    // select another bus (see OneWire32::route())
+    virtual bool route(uint8_t /*pin*/) { return false; }
+};
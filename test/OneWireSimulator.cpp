@@ -0,0 +1,375 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) Mathieu Carbou
+ */
+#include "OneWireSimulator.h"
+
+#include <esp32-hal.h>
+#include <string.h>
+
+#define SIM_DS18S20  0x10
+#define SIM_POWER_ON 1360
+
+uint64_t OneWireSimulator::rom(uint8_t family, uint64_t serial) {
+  uint8_t r[8];
+  r[0] = family;
+  for (uint8_t i = 1; i < 7; i++)
+    r[i] = serial >> (8 * (i - 1));
+  r[7] = crc8(r, 7);
+  uint64_t code;
+  memcpy(&code, r, 8);
+  return code;
+}
+
+uint8_t OneWireSimulator::crc8(const uint8_t* data, uint8_t len) {
+  uint8_t crc = 0;
+  for (uint8_t i = 0; i < len; i++) {
+    uint8_t b = data[i];
+    for (uint8_t j = 0; j < 8; j++) {
+      const uint8_t mix = (crc ^ b) & 0x01;
+      crc >>= 1;
+      if (mix)
+        crc ^= 0x8C;
+      b >>= 1;
+    }
+  }
+  return crc;
+}
+
+uint64_t OneWireSimulator::add(const Device& device) {
+  Slave slave;
+  slave.device = device;
+  if (!(device.rom >> 56))
+    slave.device.rom = rom(device.rom & 0xFF, device.rom >> 8);
+  slave.latched = SIM_POWER_ON;
+  slave.th = static_cast<uint8_t>(device.alarmHigh);
+  slave.tl = static_cast<uint8_t>(device.alarmLow);
+  const uint8_t resolution = device.resolution < 9 || device.resolution > 12 ? 12 : device.resolution;
+  slave.config = ((resolution - 9) << 5) | 0x1F;
+  slave.eeprom[0] = slave.th;
+  slave.eeprom[1] = slave.tl;
+  slave.eeprom[2] = slave.config;
+  std::lock_guard<std::mutex> lock(_mutex);
+  _slaves.push_back(slave);
+  return slave.device.rom;
+}
+
+bool OneWireSimulator::remove(uint64_t rom) {
+  std::lock_guard<std::mutex> lock(_mutex);
+  for (size_t i = 0; i < _slaves.size(); i++) {
+    if (_slaves[i].device.rom == rom) {
+      _slaves.erase(_slaves.begin() + i);
+      return true;
+    }
+  }
+  return false;
+}
+
+size_t OneWireSimulator::size() const {
+  std::lock_guard<std::mutex> lock(_mutex);
+  return _slaves.size();
+}
+
+std::vector<uint64_t> OneWireSimulator::roms() const {
+  std::lock_guard<std::mutex> lock(_mutex);
+  std::vector<uint64_t> result;
+  for (const Slave& slave : _slaves)
+    result.push_back(slave.device.rom);
+  return result;
+}
+
+bool OneWireSimulator::setTemperature(uint64_t rom, int16_t raw) {
+  std::lock_guard<std::mutex> lock(_mutex);
+  Slave* slave = _find(rom);
+  if (!slave)
+    return false;
+  slave->device.temperature = raw;
+  return true;
+}
+
+bool OneWireSimulator::corrupt(uint64_t rom, uint32_t reads) {
+  std::lock_guard<std::mutex> lock(_mutex);
+  Slave* slave = _find(rom);
+  if (!slave)
+    return false;
+  slave->corrupted = reads;
+  return true;
+}
+
+uint8_t OneWireSimulator::getResolution(uint64_t rom) const {
+  std::lock_guard<std::mutex> lock(_mutex);
+  const Slave* slave = _find(rom);
+  return slave ? 9 + ((slave->config >> 5) & 0x03) : 0;
+}
+
+bool OneWireSimulator::isPersisted(uint64_t rom) const {
+  std::lock_guard<std::mutex> lock(_mutex);
+  const Slave* slave = _find(rom);
+  return slave && slave->persisted;
+}
+
+OneWireSimulator::Slave* OneWireSimulator::_find(uint64_t rom) {
+  for (Slave& slave : _slaves)
+    if (slave.device.rom == rom)
+      return &slave;
+  return nullptr;
+}
+
+const OneWireSimulator::Slave* OneWireSimulator::_find(uint64_t rom) const {
+  for (const Slave& slave : _slaves)
+    if (slave.device.rom == rom)
+      return &slave;
+  return nullptr;
+}
+
+bool OneWireSimulator::reset() {
+  std::lock_guard<std::mutex> lock(_mutex);
+  _counters.resets++;
+  const bool silent = _silent > 0;
+  if (silent)
+    _silent--;
+  for (Slave& slave : _slaves) {
+    _update(slave);
+    slave.state = silent ? State::IDLE : State::ROM_COMMAND;
+    slave.bits = 0;
+    slave.byte = 0;
+    slave.index = 0;
+  }
+  return !silent && !_slaves.empty();
+}
+
+bool OneWireSimulator::slot(bool one) {
+  std::lock_guard<std::mutex> lock(_mutex);
+  _counters.slots++;
+  bool level = one;
+  for (Slave& slave : _slaves) {
+    _update(slave);
+    if (slave.state != State::IDLE && !_drive(slave))
+      level = false;
+  }
+  for (Slave& slave : _slaves)
+    if (slave.state != State::IDLE)
+      _sample(slave, level);
+  return level;
+}
+
+bool OneWireSimulator::read(uint8_t& data, uint8_t len) {
+  data = 0;
+  for (uint8_t i = 0; i < len; i++)
+    if (slot(true))
+      data |= 1 << i;
+  return true;
+}
+
+bool OneWireSimulator::write(const uint8_t data, uint8_t len) {
+  for (uint8_t i = 0; i < len; i++)
+    slot((data >> i) & 0x01);
+  return true;
+}
+
+bool OneWireSimulator::writeBytes(const uint8_t* data, uint8_t len) {
+  for (uint8_t i = 0; i < len; i++)
+    write(data[i], 8);
+  return true;
+}
+
+bool OneWireSimulator::readBytes(uint8_t* data, uint8_t len) {
+  for (uint8_t i = 0; i < len; i++)
+    read(data[i], 8);
+  return true;
+}
+
+bool OneWireSimulator::_drive(const Slave& slave) const {
+  switch (slave.state) {
+    case State::SEARCH: {
+      const bool bit = (slave.device.rom >> slave.index) & 0x01;
+      if (slave.search == 0)
+        return bit;
+      if (slave.search == 1)
+        return !bit;
+      return true;
+    }
+    case State::SEND:
+      return slave.index >= slave.outLen || ((slave.out[slave.index] >> slave.bits) & 0x01);
+    case State::STATUS:
+      // parasite-powered devices pull the line low on Read Power Supply, and cannot answer while converting
+      if (slave.function == 0xB4)
+        return !slave.device.parasite;
+      return slave.device.parasite || !slave.converting;
+    default:
+      return true;
+  }
+}
+
+void OneWireSimulator::_sample(Slave& slave, bool level) {
+  switch (slave.state) {
+    case State::MATCH:
+      if (level != ((slave.device.rom >> slave.index) & 0x01)) {
+        slave.state = State::IDLE;
+      } else if (++slave.index == 64) {
+        slave.state = State::FUNCTION;
+      }
+      return;
+    case State::SEARCH:
+      if (slave.search < 2) {
+        slave.search++;
+      } else if (level != ((slave.device.rom >> slave.index) & 0x01)) {
+        slave.state = State::IDLE;
+      } else {
+        slave.search = 0;
+        if (++slave.index == 64)
+          slave.state = State::FUNCTION;
+      }
+      return;
+    case State::SEND:
+      if (++slave.bits == 8) {
+        slave.bits = 0;
+        if (slave.index < slave.outLen)
+          slave.index++;
+      }
+      return;
+    case State::STATUS:
+      return;
+    default:
+      slave.byte |= (level ? 1 : 0) << slave.bits;
+      if (++slave.bits == 8) {
+        const uint8_t byte = slave.byte;
+        slave.bits = 0;
+        slave.byte = 0;
+        _receive(slave, byte);
+      }
+      return;
+  }
+}
+
+void OneWireSimulator::_receive(Slave& slave, uint8_t byte) {
+  const bool family10 = (slave.device.rom & 0xFF) == SIM_DS18S20;
+  slave.index = 0;
+  switch (slave.state) {
+    case State::ROM_COMMAND:
+      switch (byte) {
+        case 0x33: // Read ROM
+          memcpy(slave.out, &slave.device.rom, 8);
+          slave.outLen = 8;
+          slave.state = State::SEND;
+          break;
+        case 0x55: // Match ROM
+          slave.state = State::MATCH;
+          break;
+        case 0xCC: // Skip ROM
+          slave.state = State::FUNCTION;
+          break;
+        case 0xEC: // Alarm Search
+        case 0xF0: // Search ROM
+          slave.search = 0;
+          // counted once for all the devices
+          if (&slave == &_slaves.front())
+            _counters.searches++;
+          slave.state = byte == 0xF0 || slave.alarm ? State::SEARCH : State::IDLE;
+          break;
+        default:
+          slave.state = State::IDLE;
+          break;
+      }
+      return;
+    case State::FUNCTION:
+      slave.function = byte;
+      switch (byte) {
+        case 0x44: // Convert T
+          _counters.conversions++;
+          slave.converting = true;
+          slave.conversionEnd = millis() + _conversionTime(slave);
+          slave.state = State::STATUS;
+          break;
+        case 0xBE: // Read Scratchpad
+          _counters.scratchpadReads++;
+          _scratchpad(slave, slave.out);
+          if (slave.corrupted) {
+            slave.corrupted--;
+            slave.out[8] ^= 0xA5;
+          }
+          slave.outLen = 9;
+          slave.state = State::SEND;
+          break;
+        case 0x4E: // Write Scratchpad
+          slave.written = 0;
+          slave.state = State::WRITE;
+          break;
+        case 0x48: // Copy Scratchpad
+          slave.eeprom[0] = slave.th;
+          slave.eeprom[1] = slave.tl;
+          slave.eeprom[2] = slave.config;
+          slave.persisted = true;
+          slave.state = State::IDLE;
+          break;
+        case 0xB4: // Read Power Supply
+          slave.state = State::STATUS;
+          break;
+        default:
+          slave.state = State::IDLE;
+          break;
+      }
+      return;
+    case State::WRITE:
+      if (slave.written == 0) {
+        slave.th = byte;
+      } else if (slave.written == 1) {
+        slave.tl = byte;
+      } else {
+        // only the resolution bits of the configuration register are writable
+        slave.config = (byte & 0x60) | 0x1F;
+      }
+      if (++slave.written == (family10 ? 2 : 3))
+        slave.state = State::IDLE;
+      return;
+    default:
+      return;
+  }
+}
+
+void OneWireSimulator::_update(Slave& slave) {
+  if (!slave.converting || static_cast<int32_t>(millis() - slave.conversionEnd) < 0)
+    return;
+  slave.converting = false;
+  int16_t t = slave.device.temperature;
+  // DS18S20 keeps the full value, decoded from COUNT_REMAIN: bits below the resolution are undefined on the others (cleared)
+  if ((slave.device.rom & 0xFF) != SIM_DS18S20)
+    t &= ~((1 << (3 - ((slave.config >> 5) & 0x03))) - 1);
+  slave.latched = t;
+  // the alarm flag compares the integer part with TH and TL
+  const int16_t whole = t >> 4;
+  slave.alarm = whole >= static_cast<int8_t>(slave.th) || whole <= static_cast<int8_t>(slave.tl);
+}
+
+void OneWireSimulator::_scratchpad(const Slave& slave, uint8_t* data) const {
+  int16_t t = slave.latched;
+  if ((slave.device.rom & 0xFF) == SIM_DS18S20) {
+    // TEMP_READ in 0.5 °C units and COUNT_REMAIN so that T = TEMP_READ - 0.25 + (COUNT_PER_C - COUNT_REMAIN) / COUNT_PER_C
+    // (85 °C gives the power-on values 0x00AA and 0x0C)
+    const int16_t whole = (t + 4 - ((t + 4) & 0x0F)) / 16;
+    t = whole * 2;
+    data[4] = 0xFF;
+    data[5] = 0xFF;
+    data[6] = whole * 16 + 12 - slave.latched;
+    data[7] = 0x10;
+  } else {
+    data[4] = slave.config;
+    data[5] = 0xFF;
+    data[6] = 0x0C;
+    data[7] = 0x10;
+  }
+  data[0] = t & 0xFF;
+  data[1] = (t >> 8) & 0xFF;
+  data[2] = slave.th;
+  data[3] = slave.tl;
+  data[8] = crc8(data, 8);
+}
+
+uint32_t OneWireSimulator::_conversionTime(const Slave& slave) const {
+  if (slave.device.conversionTime)
+    return slave.device.conversionTime;
+  if ((slave.device.rom & 0xFF) == SIM_DS18S20)
+    return 750;
+  static const uint16_t times[] = {94, 188, 375, 750};
+  return times[(slave.config >> 5) & 0x03];
+}
@@ -0,0 +1,146 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) Mathieu Carbou
+ */
+#pragma once
+
+#include "esp32-ds18b20/OneWireTransport.h"
+#include "host.h"
+
+#include <stdint.h>
+
+#include <mutex>
+#include <vector>
+
+// Simulated 1-Wire bus of DS18 sensors, modelled slot by slot (wired-AND of the master and the devices).
+// It can be attached to a pin to be driven by the RMT stand-in (see host::attach()), or used as the transport of a OneWire32.
+// Supported commands: Read ROM, Match ROM, Skip ROM, Search ROM, Alarm Search,
+// Convert T, Read Scratchpad, Write Scratchpad, Copy Scratchpad and Read Power Supply.
+class OneWireSimulator : public host::SlotBus, public OneWireTransport {
+  public:
+    struct Device {
+        // ROM code: family code in the low byte, the CRC byte is computed by add() if 0
+        uint64_t rom = 0;
+        // temperature latched by the next conversion in 1/16 °C
+        int16_t temperature = 0;
+        // 9 to 12 bits (configuration register), DS18S20 is always 9 bits
+        uint8_t resolution = 12;
+        // conversion time in milliseconds, 0 for the datasheet time of the resolution
+        uint32_t conversionTime = 0;
+        // TH and TL registers
+        int8_t alarmHigh = 125;
+        int8_t alarmLow = -55;
+        bool parasite = false;
+    };
+
+    // bus usage seen by the devices
+    struct Counters {
+        uint32_t resets = 0;
+        uint32_t slots = 0;
+        // Search ROM and Alarm Search commands
+        uint32_t searches = 0;
+        uint32_t conversions = 0;
+        uint32_t scratchpadReads = 0;
+    };
+
+    // hot-plug: returns the ROM code of the device
+    uint64_t add(const Device& device);
+    bool remove(uint64_t rom);
+    size_t size() const;
+    std::vector<uint64_t> roms() const;
+
+    bool setTemperature(uint64_t rom, int16_t raw);
+    // next scratchpad reads of a device return a wrong CRC
+    bool corrupt(uint64_t rom, uint32_t reads = 1);
+    // next reset pulses are not answered (i.e. disconnected bus): the devices stay silent until the next answered reset
+    void silence(uint32_t resets) {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _silent = resets;
+    }
+    // configuration register of a device as written by the master
+    uint8_t getResolution(uint64_t rom) const;
+    // configuration copied to the EEPROM
+    bool isPersisted(uint64_t rom) const;
+
+    Counters counters() const {
+      std::lock_guard<std::mutex> lock(_mutex);
+      return _counters;
+    }
+    void clearCounters() {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _counters = Counters();
+    }
+
+    // ROM code with a valid CRC
+    static uint64_t rom(uint8_t family, uint64_t serial);
+    static uint8_t crc8(const uint8_t* data, uint8_t len);
+
+    // host::SlotBus
+    bool reset() override;
+    bool slot(bool one) override;
+
+    // OneWireTransport
+    bool read(uint8_t& data, uint8_t len) override;
+    bool write(const uint8_t data, uint8_t len) override;
+    bool writeBytes(const uint8_t* data, uint8_t len) override;
+    bool readBytes(uint8_t* data, uint8_t len) override;
+
+  private:
+    enum class State {
+      // not selected until the next reset
+      IDLE,
+      ROM_COMMAND,
+      MATCH,
+      SEARCH,
+      FUNCTION,
+      // sending the out bytes, then ones
+      SEND,
+      // receiving scratchpad bytes
+      WRITE,
+      // sending the power supply bit or the conversion status
+      STATUS
+    };
+
+    struct Slave {
+        Device device;
+        // registers
+        int16_t latched;
+        uint8_t th;
+        uint8_t tl;
+        uint8_t config;
+        uint8_t eeprom[3];
+        bool persisted = false;
+        // alarm flag of the last conversion
+        bool alarm = false;
+        uint32_t corrupted = 0;
+        // conversion in progress: end time in milliseconds
+        bool converting = false;
+        uint32_t conversionEnd = 0;
+        // protocol
+        State state = State::IDLE;
+        uint8_t bits = 0;
+        uint8_t byte = 0;
+        uint8_t index = 0;
+        // search: 0 = send the bit, 1 = send its complement, 2 = receive the direction
+        uint8_t search = 0;
+        uint8_t function = 0;
+        uint8_t out[9];
+        uint8_t outLen = 0;
+        uint8_t written = 0;
+    };
+
+    mutable std::mutex _mutex;
+    std::vector<Slave> _slaves;
+    uint32_t _silent = 0;
+    Counters _counters;
+
+    Slave* _find(uint64_t rom);
+    const Slave* _find(uint64_t rom) const;
+    // level the device drives during the slot: false to pull the line low
+    bool _drive(const Slave& slave) const;
+    void _sample(Slave& slave, bool level);
+    void _receive(Slave& slave, uint8_t byte);
+    void _update(Slave& slave);
+    void _scratchpad(const Slave& slave, uint8_t* data) const;
+    uint32_t _conversionTime(const Slave& slave) const;
+};
@@ -0,0 +1,125 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) Mathieu Carbou
+ */
+#include "OneWireSimulator.h"
+#include "bench_expected.h"
+
+#include <MycilaDS18.h>
+
+#include <stdio.h>
+#include <string.h>
+
+// Host version of the Benchmark example: bus usage of each operation on 1, 8, 32 and 64 simulated sensors,
+// driven through the RMT stand-in so that the RMT transactions are counted as on the device.
+// The bus time is modelled from the durations of the transmitted RMT symbols (700 us per reset, 67 us per slot):
+// unlike Stats::time, it does not depend on the host.
+// Prints one JSON line per operation and fails if an operation uses more transactions, resets, slots or bus time
+// than recorded in bench_expected.h (update the table when an operation gets cheaper).
+
+#define PIN 18
+
+static const uint8_t SIZES[] = {1, 8, 32, 64};
+
+static int regressions = 0;
+static int improvements = 0;
+
+// modelled bus time in microseconds of the symbols transmitted since the last host::clearTransmitted()
+static uint32_t busTime() {
+  uint32_t us = 0;
+  for (const rmt_symbol_word_t& symbol : host::transmitted())
+    us += symbol.duration0 + symbol.duration1;
+  return us;
+}
+
+static void check(const char* op, uint8_t devices, const OneWire32::Stats& stats, uint32_t time) {
+  printf("{\"op\":\"%s\",\"devices\":%u,\"transactions\":%u,\"resets\":%u,\"slots\":%u,\"time\":%u}\n", op, devices, stats.transactions, stats.resets, stats.slots, time);
+  for (const BenchExpected& expected : BENCH_EXPECTED) {
+    if (strcmp(expected.op, op) || expected.devices != devices)
+      continue;
+    if (stats.transactions > expected.transactions || stats.resets > expected.resets || stats.slots > expected.slots || time > expected.time) {
+      printf("  REGRESSION: expected at most %u transactions, %u resets, %u slots, %u us\n", expected.transactions, expected.resets, expected.slots, expected.time);
+      regressions++;
+    } else if (stats.transactions < expected.transactions || stats.resets < expected.resets || stats.slots < expected.slots || time < expected.time) {
+      printf("  improved: update bench_expected.h (%u transactions, %u resets, %u slots, %u us)\n", expected.transactions, expected.resets, expected.slots, expected.time);
+      improvements++;
+    }
+    return;
+  }
+  printf("  MISSING in bench_expected.h\n");
+  regressions++;
+}
+
+template <typename F>
+static void measure(OneWire32& ow, const char* op, uint8_t devices, F&& fn) {
+  OneWire32::Stats stats;
+  uint32_t time;
+  {
+    std::lock_guard<OneWire32> lock(ow);
+    ow.clearStats();
+    host::clearTransmitted();
+    fn();
+    stats = ow.stats();
+    time = busTime();
+  }
+  check(op, devices, stats, time);
+}
+
+int main() {
+  for (uint8_t size : SIZES) {
+    OneWireSimulator sim;
+    for (uint8_t i = 0; i < size; i++) {
+      OneWireSimulator::Device device;
+      device.rom = OneWireSimulator::rom(MYCILA_DS18_DS18B20, 0x5A0000 + i * 0x1041);
+      device.temperature = 20 * 16 + i;
+      sim.add(device);
+    }
+    host::attach(PIN, &sim);
+    {
+      OneWire32 ow(PIN);
+      uint64_t addresses[64];
+      uint8_t found = 0;
+
+      measure(ow, "search", size, [&]() { found = ow.search(addresses, 64); });
+      if (found != size) {
+        printf("  FAILED: %u devices found\n", found);
+        return 1;
+      }
+
+      measure(ow, "request", size, [&]() { ow.request(); });
+      host::advance(MYCILA_DS18_CONVERSION_TIME_MS);
+
+      measure(ow, "getTemp", size, [&]() {
+        float t;
+        ow.getTemp(addresses[0], t);
+      });
+
+      measure(ow, "getTempFast", size, [&]() {
+        int16_t raw;
+        ow.getTempFast(addresses[0], raw);
+      });
+
+      // every sensor once, as a bus read cycle
+      measure(ow, "getTemp*", size, [&]() {
+        float t;
+        for (uint8_t i = 0; i < found; i++)
+          ow.getTemp(addresses[i], t);
+      });
+
+      // full cycle of a sensor: scratchpad read and next conversion request
+      Mycila::DS18 temp;
+      temp.begin(&ow, addresses[0]);
+      host::advance(temp.getConversionTime());
+      measure(ow, "DS18::read", size, [&]() { temp.read(); });
+    }
+    host::attach(PIN, nullptr);
+  }
+
+  if (improvements)
+    printf("%d operation(s) improved\n", improvements);
+  if (regressions) {
+    printf("%d regression(s)\n", regressions);
+    return 1;
+  }
+  return 0;
+}
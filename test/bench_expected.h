@@ -0,0 +1,46 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) Mathieu Carbou
+ */
+#pragma once
+
+#include <stdint.h>
+
+// bus usage of each operation measured by bench.cpp: the benchmark fails if an operation uses more
+struct BenchExpected {
+    const char* op;
+    uint8_t devices;
+    uint32_t transactions;
+    uint32_t resets;
+    uint32_t slots;
+    // modelled bus time in microseconds
+    uint32_t time;
+};
+
+static const BenchExpected BENCH_EXPECTED[] = {
+  // op, devices, transactions, resets, slots, time
+  {"search", 1, 67, 1, 200, 14100},
+  {"search", 8, 536, 8, 1600, 112800},
+  {"search", 32, 2144, 32, 6400, 451200},
+  {"search", 64, 4288, 64, 12800, 902400},
+  {"request", 1, 2, 1, 16, 1772},
+  {"request", 8, 2, 1, 16, 1772},
+  {"request", 32, 2, 1, 16, 1772},
+  {"request", 64, 2, 1, 16, 1772},
+  {"getTemp", 1, 4, 1, 152, 10884},
+  {"getTemp", 8, 4, 1, 152, 10884},
+  {"getTemp", 32, 4, 1, 152, 10884},
+  {"getTemp", 64, 4, 1, 152, 10884},
+  {"getTempFast", 1, 4, 2, 96, 7832},
+  {"getTempFast", 8, 4, 2, 96, 7832},
+  {"getTempFast", 32, 4, 2, 96, 7832},
+  {"getTempFast", 64, 4, 2, 96, 7832},
+  {"getTemp*", 1, 4, 1, 152, 10884},
+  {"getTemp*", 8, 32, 8, 1216, 87072},
+  {"getTemp*", 32, 128, 32, 4864, 348288},
+  {"getTemp*", 64, 256, 64, 9728, 696576},
+  {"DS18::read", 1, 6, 2, 232, 16944},
+  {"DS18::read", 8, 6, 2, 232, 16944},
+  {"DS18::read", 32, 6, 2, 232, 16944},
+  {"DS18::read", 64, 6, 2, 232, 16944},
+};
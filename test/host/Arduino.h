@@ -0,0 +1,5 @@
+// SPDX-License-Identifier: MIT
+// Host stand-in for the Arduino core: see test/host/host.h
+#pragma once
+
+#include "esp32-hal.h"
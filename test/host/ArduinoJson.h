@@ -0,0 +1,182 @@
+// SPDX-License-Identifier: MIT
+// Host stand-in for ArduinoJson 7: the subset of the API used by the library (toJson()), as a tree of nodes
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+struct JsonNode {
+    enum Type {
+      NUL,
+      BOOLEAN,
+      INTEGER,
+      FLOAT,
+      STRING,
+      OBJECT,
+      ARRAY
+    };
+    Type type = NUL;
+    bool boolean = false;
+    int64_t integer = 0;
+    double number = 0;
+    std::string string;
+    std::vector<std::pair<std::string, std::shared_ptr<JsonNode>>> members;
+    std::vector<std::shared_ptr<JsonNode>> items;
+
+    void reset(Type t) {
+      type = t;
+      members.clear();
+      items.clear();
+    }
+};
+
+class JsonObject;
+class JsonArray;
+
+class JsonVariant {
+  public:
+    JsonVariant() = default;
+    explicit JsonVariant(std::shared_ptr<JsonNode> node) : _node(std::move(node)) {}
+
+    template <typename T>
+    const JsonVariant& operator=(T value) const {
+      set(*_node, value);
+      return *this;
+    }
+
+    template <typename T>
+    T to() const;
+
+    template <typename T>
+    T as() const;
+
+    JsonVariant operator[](const char* key) const;
+    JsonVariant operator[](size_t index) const;
+    size_t size() const { return _node ? (_node->type == JsonNode::OBJECT ? _node->members.size() : _node->items.size()) : 0; }
+    bool isNull() const { return !_node || _node->type == JsonNode::NUL; }
+
+    template <typename T>
+    static void set(JsonNode& node, T value) {
+      if constexpr (std::is_same<T, bool>::value) {
+        node.reset(JsonNode::BOOLEAN);
+        node.boolean = value;
+      } else if constexpr (std::is_integral<T>::value) {
+        node.reset(JsonNode::INTEGER);
+        node.integer = static_cast<int64_t>(value);
+      } else if constexpr (std::is_floating_point<T>::value) {
+        node.reset(JsonNode::FLOAT);
+        node.number = value;
+      } else {
+        node.reset(JsonNode::STRING);
+        node.string = value ? value : "";
+      }
+    }
+
+  private:
+    std::shared_ptr<JsonNode> _node;
+};
+
+class JsonObject {
+  public:
+    JsonObject() = default;
+    explicit JsonObject(std::shared_ptr<JsonNode> node) : _node(std::move(node)) {}
+
+    // adds the member if missing
+    JsonVariant operator[](const char* key) const {
+      for (const auto& member : _node->members) {
+        if (member.first == key) {
+          return JsonVariant(member.second);
+        }
+      }
+      _node->members.push_back({key, std::make_shared<JsonNode>()});
+      return JsonVariant(_node->members.back().second);
+    }
+    size_t size() const { return _node ? _node->members.size() : 0; }
+    bool isNull() const { return !_node; }
+
+  private:
+    std::shared_ptr<JsonNode> _node;
+};
+
+class JsonArray {
+  public:
+    JsonArray() = default;
+    explicit JsonArray(std::shared_ptr<JsonNode> node) : _node(std::move(node)) {}
+
+    // nested array or object
+    template <typename T>
+    T add() const {
+      _node->items.push_back(std::make_shared<JsonNode>());
+      return JsonVariant(_node->items.back()).to<T>();
+    }
+    template <typename T>
+    bool add(T value) const {
+      _node->items.push_back(std::make_shared<JsonNode>());
+      JsonVariant::set(*_node->items.back(), value);
+      return true;
+    }
+    JsonVariant operator[](size_t index) const { return index < size() ? JsonVariant(_node->items[index]) : JsonVariant(); }
+    size_t size() const { return _node ? _node->items.size() : 0; }
+    bool isNull() const { return !_node; }
+
+  private:
+    std::shared_ptr<JsonNode> _node;
+};
+
+template <typename T>
+T JsonVariant::to() const {
+  static_assert(std::is_same<T, JsonObject>::value || std::is_same<T, JsonArray>::value, "JsonObject or JsonArray");
+  _node->reset(std::is_same<T, JsonObject>::value ? JsonNode::OBJECT : JsonNode::ARRAY);
+  return T(_node);
+}
+
+template <typename T>
+T JsonVariant::as() const {
+  if constexpr (std::is_same<T, JsonObject>::value) {
+    return _node && _node->type == JsonNode::OBJECT ? JsonObject(_node) : JsonObject();
+  } else if constexpr (std::is_same<T, JsonArray>::value) {
+    return _node && _node->type == JsonNode::ARRAY ? JsonArray(_node) : JsonArray();
+  } else if constexpr (std::is_same<T, std::string>::value) {
+    return _node && _node->type == JsonNode::STRING ? _node->string : std::string();
+  } else {
+    if (!_node) {
+      return T();
+    }
+    switch (_node->type) {
+      case JsonNode::BOOLEAN:
+        return static_cast<T>(_node->boolean);
+      case JsonNode::INTEGER:
+        return static_cast<T>(_node->integer);
+      case JsonNode::FLOAT:
+        return static_cast<T>(_node->number);
+      default:
+        return T();
+    }
+  }
+}
+
+inline JsonVariant JsonVariant::operator[](const char* key) const {
+  return _node && _node->type == JsonNode::OBJECT ? JsonObject(_node)[key] : JsonVariant();
+}
+
+inline JsonVariant JsonVariant::operator[](size_t index) const {
+  return _node && _node->type == JsonNode::ARRAY ? JsonArray(_node)[index] : JsonVariant();
+}
+
+class JsonDocument {
+  public:
+    template <typename T>
+    T to() {
+      return JsonVariant(_root).to<T>();
+    }
+    JsonVariant operator[](const char* key) const { return JsonVariant(_root)[key]; }
+
+  private:
+    std::shared_ptr<JsonNode> _root = std::make_shared<JsonNode>();
+};
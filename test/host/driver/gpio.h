@@ -0,0 +1,22 @@
+// SPDX-License-Identifier: MIT
+// Host stand-in for ESP-IDF: levels are recorded (see host::level())
+#pragma once
+
+#include "esp_err.h"
+
+typedef enum {
+  GPIO_NUM_NC = -1,
+  GPIO_NUM_0 = 0,
+  GPIO_NUM_MAX = 40
+} gpio_num_t;
+
+typedef enum {
+  GPIO_MODE_INPUT = 1,
+  GPIO_MODE_OUTPUT = 2
+} gpio_mode_t;
+
+#define SOC_GPIO_VALID_OUTPUT_GPIO_MASK 0xFFFFFFFFFFULL
+
+esp_err_t gpio_reset_pin(gpio_num_t gpio_num);
+esp_err_t gpio_set_direction(gpio_num_t gpio_num, gpio_mode_t mode);
+esp_err_t gpio_set_level(gpio_num_t gpio_num, uint32_t level);
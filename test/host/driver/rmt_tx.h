@@ -0,0 +1,5 @@
+// SPDX-License-Identifier: MIT
+// Host stand-in for ESP-IDF: see driver/rmt_types.h
+#pragma once
+
+#include "driver/rmt_types.h"
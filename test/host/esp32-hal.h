@@ -0,0 +1,22 @@
+// SPDX-License-Identifier: MIT
+// Host stand-in for the Arduino core: see test/host/host.h
+#pragma once
+
+#include <inttypes.h>
+#include <stdint.h>
+
+#include "driver/gpio.h"
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+uint32_t millis();
+void delay(uint32_t ms);
+
+// printed when the HOST_LOG environment variable is set
+void host_log(char level, const char* tag, const char* format, ...);
+
+#define ESP_LOGE(tag, format, ...) host_log('E', tag, format, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) host_log('W', tag, format, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) host_log('I', tag, format, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...) host_log('D', tag, format, ##__VA_ARGS__)
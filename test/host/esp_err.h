@@ -0,0 +1,15 @@
+// SPDX-License-Identifier: MIT
+// Host stand-in for ESP-IDF: see test/host/host.h
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef int esp_err_t;
+
+#define ESP_OK                0
+#define ESP_FAIL              -1
+#define ESP_ERR_NOT_FOUND     0x105
+#define ESP_ERR_NVS_NOT_FOUND 0x1102
+
+#define IRAM_ATTR
@@ -0,0 +1,6 @@
+// SPDX-License-Identifier: MIT
+// Host stand-in for ESP-IDF: see test/host/host.h
+#pragma once
+
+#define ESP_IDF_VERSION_VAL(major, minor, patch) (((major) << 16) | ((minor) << 8) | (patch))
+#define ESP_IDF_VERSION                          ESP_IDF_VERSION_VAL(5, 4, 0)
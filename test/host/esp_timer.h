@@ -0,0 +1,8 @@
+// SPDX-License-Identifier: MIT
+// Host stand-in for ESP-IDF: see test/host/host.h
+#pragma once
+
+#include <stdint.h>
+
+// microseconds on the host clock (see host::advance())
+int64_t esp_timer_get_time();
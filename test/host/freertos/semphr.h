@@ -0,0 +1,18 @@
+// SPDX-License-Identifier: MIT
+// Host stand-in for FreeRTOS: see freertos/FreeRTOS.h
+#pragma once
+
+#include "freertos/queue.h"
+
+typedef struct host_semaphore* SemaphoreHandle_t;
+
+// storage of a semaphore created without allocation
+typedef struct {
+    alignas(16) unsigned char data[256];
+} StaticSemaphore_t;
+
+SemaphoreHandle_t xSemaphoreCreateBinary();
+SemaphoreHandle_t xSemaphoreCreateBinaryStatic(StaticSemaphore_t* buffer);
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks);
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore);
+void vSemaphoreDelete(SemaphoreHandle_t semaphore);
@@ -0,0 +1,554 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) Mathieu Carbou
+ */
+#include "host.h"
+
+#include "driver/rmt_rx.h"
+#include "driver/rmt_tx.h"
+#include "esp32-hal.h"
+#include "esp_timer.h"
+#include "freertos/semphr.h"
+#include "nvs.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <new>
+#include <string>
+#include <thread>
+
+// clock
+
+static const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+static std::atomic<int64_t> offset{0};
+
+int64_t esp_timer_get_time() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count() + offset;
+}
+
+uint32_t millis() {
+  return static_cast<uint32_t>(esp_timer_get_time() / 1000);
+}
+
+void delay(uint32_t ms) {
+  std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+void host::advance(uint32_t ms) {
+  offset += static_cast<int64_t>(ms) * 1000;
+}
+
+void host_log(char level, const char* tag, const char* format, ...) {
+  if (!getenv("HOST_LOG")) {
+    return;
+  }
+  va_list args;
+  va_start(args, format);
+  printf("[%6" PRIu32 "][%c][%s] ", millis(), level, tag);
+  vprintf(format, args);
+  printf("\n");
+  va_end(args);
+}
+
+// wait for a condition with a FreeRTOS timeout in ticks (milliseconds)
+
+template <typename Wait>
+static bool waitFor(std::unique_lock<std::mutex>& lock, std::condition_variable& cv, TickType_t ticks, Wait ready) {
+  if (ticks == portMAX_DELAY) {
+    cv.wait(lock, ready);
+    return true;
+  }
+  return cv.wait_for(lock, std::chrono::milliseconds(ticks), ready);
+}
+
+// tasks
+
+struct host_task {
+    std::mutex mutex;
+    std::condition_variable cv;
+    uint32_t notified = 0;
+};
+
+static thread_local host_task* current = nullptr;
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char* name, uint32_t stack, void* arg, UBaseType_t priority, TaskHandle_t* handle) {
+  return xTaskCreatePinnedToCore(fn, name, stack, arg, priority, handle, tskNO_AFFINITY);
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char*, uint32_t, void* arg, UBaseType_t, TaskHandle_t* handle, BaseType_t) {
+  host_task* task = new host_task();
+  if (handle) {
+    *handle = task;
+  }
+  std::thread([fn, arg, task]() {
+    current = task;
+    fn(arg);
+    // the task deleted itself
+    delete task;
+  }).detach();
+  return pdPASS;
+}
+
+// the task function returns right after vTaskDelete(NULL): its thread then ends
+void vTaskDelete(TaskHandle_t) {}
+
+void vTaskDelay(TickType_t ticks) {
+  std::this_thread::sleep_for(std::chrono::milliseconds(ticks));
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle() {
+  if (!current) {
+    current = new host_task();
+  }
+  return current;
+}
+
+TickType_t xTaskGetTickCount() {
+  return millis();
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t ticks) {
+  host_task* task = xTaskGetCurrentTaskHandle();
+  std::unique_lock<std::mutex> lock(task->mutex);
+  waitFor(lock, task->cv, ticks, [task]() { return task->notified > 0; });
+  const uint32_t value = task->notified;
+  if (value) {
+    task->notified = clear ? 0 : value - 1;
+  }
+  return value;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task) {
+  std::lock_guard<std::mutex> lock(task->mutex);
+  task->notified++;
+  task->cv.notify_all();
+  return pdPASS;
+}
+
+// queues
+
+struct host_queue {
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<std::string> items;
+    size_t length;
+    size_t size;
+};
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t size) {
+  host_queue* queue = new host_queue();
+  queue->length = length;
+  queue->size = size;
+  return queue;
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void* item, TickType_t ticks) {
+  std::unique_lock<std::mutex> lock(queue->mutex);
+  if (!waitFor(lock, queue->cv, ticks, [queue]() { return queue->items.size() < queue->length; })) {
+    return pdFALSE;
+  }
+  queue->items.emplace_back(static_cast<const char*>(item), queue->size);
+  queue->cv.notify_all();
+  return pdTRUE;
+}
+
+BaseType_t xQueueSendFromISR(QueueHandle_t queue, const void* item, BaseType_t* woken) {
+  if (woken) {
+    *woken = pdFALSE;
+  }
+  return xQueueSend(queue, item, 0);
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void* item, TickType_t ticks) {
+  std::unique_lock<std::mutex> lock(queue->mutex);
+  if (!waitFor(lock, queue->cv, ticks, [queue]() { return !queue->items.empty(); })) {
+    return pdFALSE;
+  }
+  memcpy(item, queue->items.front().data(), queue->size);
+  queue->items.pop_front();
+  queue->cv.notify_all();
+  return pdTRUE;
+}
+
+void vQueueDelete(QueueHandle_t queue) {
+  delete queue;
+}
+
+// binary semaphores
+
+struct host_semaphore {
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool given = false;
+    bool allocated = false;
+};
+
+static_assert(sizeof(host_semaphore) <= sizeof(StaticSemaphore_t), "StaticSemaphore_t too small");
+
+SemaphoreHandle_t xSemaphoreCreateBinary() {
+  host_semaphore* semaphore = new host_semaphore();
+  semaphore->allocated = true;
+  return semaphore;
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinaryStatic(StaticSemaphore_t* buffer) {
+  return new (buffer->data) host_semaphore();
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks) {
+  std::unique_lock<std::mutex> lock(semaphore->mutex);
+  if (!waitFor(lock, semaphore->cv, ticks, [semaphore]() { return semaphore->given; })) {
+    return pdFALSE;
+  }
+  semaphore->given = false;
+  return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore) {
+  std::lock_guard<std::mutex> lock(semaphore->mutex);
+  if (semaphore->given) {
+    return pdFALSE;
+  }
+  semaphore->given = true;
+  semaphore->cv.notify_all();
+  return pdTRUE;
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t semaphore) {
+  if (semaphore->allocated) {
+    delete semaphore;
+  } else {
+    semaphore->~host_semaphore();
+  }
+}
+
+// GPIO
+
+static std::mutex gpioMutex;
+static int gpioLevels[GPIO_NUM_MAX];
+static bool gpioOutputs[GPIO_NUM_MAX];
+
+esp_err_t gpio_reset_pin(gpio_num_t gpio_num) {
+  if (gpio_num < 0 || gpio_num >= GPIO_NUM_MAX) {
+    return ESP_FAIL;
+  }
+  std::lock_guard<std::mutex> lock(gpioMutex);
+  gpioOutputs[gpio_num] = false;
+  gpioLevels[gpio_num] = 0;
+  return ESP_OK;
+}
+
+esp_err_t gpio_set_direction(gpio_num_t gpio_num, gpio_mode_t mode) {
+  if (gpio_num < 0 || gpio_num >= GPIO_NUM_MAX) {
+    return ESP_FAIL;
+  }
+  std::lock_guard<std::mutex> lock(gpioMutex);
+  gpioOutputs[gpio_num] = mode == GPIO_MODE_OUTPUT;
+  return ESP_OK;
+}
+
+esp_err_t gpio_set_level(gpio_num_t gpio_num, uint32_t level) {
+  if (gpio_num < 0 || gpio_num >= GPIO_NUM_MAX) {
+    return ESP_FAIL;
+  }
+  std::lock_guard<std::mutex> lock(gpioMutex);
+  gpioLevels[gpio_num] = level ? 1 : 0;
+  return ESP_OK;
+}
+
+int host::level(uint8_t pin) {
+  std::lock_guard<std::mutex> lock(gpioMutex);
+  return pin < GPIO_NUM_MAX && gpioOutputs[pin] ? gpioLevels[pin] : -1;
+}
+
+// RMT: a transmission is played slot by slot on the devices attached to the pin,
+// and the line levels are received by the RX channel of the same pin (open drain with loop back)
+
+// longest low pulse of a read slot sampled as 1 by OneWire32
+#define HOST_SLOT_SAMPLE 15
+// shortest low pulse of a reset
+#define HOST_RESET_PULSE 480
+
+struct rmt_encoder_t {
+    bool bytes;
+    rmt_symbol_word_t bit0;
+    rmt_symbol_word_t bit1;
+};
+
+struct rmt_channel_t {
+    bool tx;
+    gpio_num_t gpio;
+    rmt_rx_done_callback_t callback = nullptr;
+    rmt_tx_done_callback_t done = nullptr;
+    void* context = nullptr;
+    // armed receive
+    rmt_symbol_word_t* buffer = nullptr;
+    size_t capacity = 0;
+    std::vector<rmt_symbol_word_t> received;
+};
+
+static std::mutex rmtMutex;
+static std::map<uint8_t, host::SlotBus*> buses;
+static std::vector<rmt_channel_t*> channels;
+static std::vector<rmt_symbol_word_t> symbolLog;
+
+void host::attach(uint8_t pin, SlotBus* bus) {
+  std::lock_guard<std::mutex> lock(rmtMutex);
+  if (bus) {
+    buses[pin] = bus;
+  } else {
+    buses.erase(pin);
+  }
+}
+
+std::vector<rmt_symbol_word_t> host::transmitted() {
+  std::lock_guard<std::mutex> lock(rmtMutex);
+  return symbolLog;
+}
+
+void host::clearTransmitted() {
+  std::lock_guard<std::mutex> lock(rmtMutex);
+  symbolLog.clear();
+}
+
+static rmt_symbol_word_t symbol(uint16_t low, uint16_t high) {
+  rmt_symbol_word_t s;
+  s.duration0 = low;
+  s.level0 = 0;
+  s.duration1 = high;
+  s.level1 = 1;
+  return s;
+}
+
+// armed RX channel of a pin: several channels may be connected to the same input
+static rmt_channel_t* receiver(gpio_num_t gpio) {
+  for (rmt_channel_t* channel : channels) {
+    if (!channel->tx && channel->gpio == gpio && channel->buffer) {
+      return channel;
+    }
+  }
+  return nullptr;
+}
+
+// end of a reception (the line stayed idle): the event is sent from the "interrupt", and the channel is disarmed
+static void deliver(rmt_channel_t* rx) {
+  if (!rx) {
+    return;
+  }
+  const size_t n = rx->received.size() < rx->capacity ? rx->received.size() : rx->capacity;
+  memcpy(rx->buffer, rx->received.data(), n * sizeof(rmt_symbol_word_t));
+  rmt_rx_done_event_data_t event;
+  event.received_symbols = rx->buffer;
+  event.num_symbols = n;
+  rx->buffer = nullptr;
+  rx->received.clear();
+  if (rx->callback) {
+    rx->callback(rx, &event, rx->context);
+  }
+}
+
+esp_err_t rmt_new_bytes_encoder(const rmt_bytes_encoder_config_t* config, rmt_encoder_handle_t* ret_encoder) {
+  // only the LSB first encoding of OneWire32 is supported
+  if (config->flags.msb_first) {
+    return ESP_FAIL;
+  }
+  *ret_encoder = new rmt_encoder_t{true, config->bit0, config->bit1};
+  return ESP_OK;
+}
+
+esp_err_t rmt_new_copy_encoder(const rmt_copy_encoder_config_t*, rmt_encoder_handle_t* ret_encoder) {
+  *ret_encoder = new rmt_encoder_t{false, {}, {}};
+  return ESP_OK;
+}
+
+esp_err_t rmt_del_encoder(rmt_encoder_handle_t encoder) {
+  delete encoder;
+  return ESP_OK;
+}
+
+esp_err_t rmt_new_rx_channel(const rmt_rx_channel_config_t* config, rmt_channel_handle_t* ret_chan) {
+  std::lock_guard<std::mutex> lock(rmtMutex);
+  rmt_channel_t* channel = new rmt_channel_t();
+  channel->tx = false;
+  channel->gpio = config->gpio_num;
+  channels.push_back(channel);
+  *ret_chan = channel;
+  return ESP_OK;
+}
+
+esp_err_t rmt_new_tx_channel(const rmt_tx_channel_config_t* config, rmt_channel_handle_t* ret_chan) {
+  std::lock_guard<std::mutex> lock(rmtMutex);
+  rmt_channel_t* channel = new rmt_channel_t();
+  channel->tx = true;
+  channel->gpio = config->gpio_num;
+  channels.push_back(channel);
+  *ret_chan = channel;
+  return ESP_OK;
+}
+
+esp_err_t rmt_rx_register_event_callbacks(rmt_channel_handle_t rx_channel, const rmt_rx_event_callbacks_t* cbs, void* user_data) {
+  std::lock_guard<std::mutex> lock(rmtMutex);
+  rx_channel->callback = cbs->on_recv_done;
+  rx_channel->context = user_data;
+  return ESP_OK;
+}
+
+esp_err_t rmt_tx_register_event_callbacks(rmt_channel_handle_t tx_channel, const rmt_tx_event_callbacks_t* cbs, void* user_data) {
+  std::lock_guard<std::mutex> lock(rmtMutex);
+  tx_channel->done = cbs->on_trans_done;
+  tx_channel->context = user_data;
+  return ESP_OK;
+}
+
+esp_err_t rmt_enable(rmt_channel_handle_t) {
+  return ESP_OK;
+}
+
+esp_err_t rmt_disable(rmt_channel_handle_t) {
+  return ESP_OK;
+}
+
+esp_err_t rmt_del_channel(rmt_channel_handle_t channel) {
+  std::lock_guard<std::mutex> lock(rmtMutex);
+  for (size_t i = 0; i < channels.size(); i++) {
+    if (channels[i] == channel) {
+      channels.erase(channels.begin() + i);
+      break;
+    }
+  }
+  delete channel;
+  return ESP_OK;
+}
+
+esp_err_t rmt_receive(rmt_channel_handle_t rx_channel, void* buffer, size_t buffer_size, const rmt_receive_config_t*) {
+  std::lock_guard<std::mutex> lock(rmtMutex);
+  rx_channel->buffer = static_cast<rmt_symbol_word_t*>(buffer);
+  rx_channel->capacity = buffer_size / sizeof(rmt_symbol_word_t);
+  rx_channel->received.clear();
+  return ESP_OK;
+}
+
+esp_err_t rmt_transmit(rmt_channel_handle_t tx_channel, rmt_encoder_handle_t encoder, const void* payload, size_t payload_bytes, const rmt_transmit_config_t*) {
+  std::vector<rmt_symbol_word_t> symbols;
+  if (encoder->bytes) {
+    const uint8_t* data = static_cast<const uint8_t*>(payload);
+    for (size_t i = 0; i < payload_bytes; i++) {
+      for (uint8_t b = 0; b < 8; b++) {
+        symbols.push_back((data[i] >> b) & 1 ? encoder->bit1 : encoder->bit0);
+      }
+    }
+  } else {
+    const rmt_symbol_word_t* data = static_cast<const rmt_symbol_word_t*>(payload);
+    symbols.assign(data, data + payload_bytes / sizeof(rmt_symbol_word_t));
+  }
+
+  std::lock_guard<std::mutex> lock(rmtMutex);
+  symbolLog.insert(symbolLog.end(), symbols.begin(), symbols.end());
+  const auto it = buses.find(tx_channel->gpio);
+  host::SlotBus* bus = it == buses.end() ? nullptr : it->second;
+  rmt_channel_t* rx = receiver(tx_channel->gpio);
+  bool idle = false;
+  for (const rmt_symbol_word_t& s : symbols) {
+    std::vector<rmt_symbol_word_t> line;
+    if (s.level0) {
+      // release symbol: the line stays high
+      idle = true;
+      continue;
+    } else if (s.duration0 >= HOST_RESET_PULSE) {
+      // the line stays idle after the presence pulse: the reception ends
+      idle = true;
+      if (bus && bus->reset()) {
+        line.push_back(symbol(s.duration0, 30));
+        line.push_back(symbol(120, 50));
+      } else {
+        line.push_back(symbol(s.duration0, 0));
+      }
+    } else {
+      const bool one = s.duration0 < HOST_SLOT_SAMPLE;
+      const bool level = bus ? bus->slot(one) : one;
+      // a device holding the line low stretches the low pulse of the slot
+      line.push_back(one && !level ? symbol(30, 35) : s);
+    }
+    if (rx) {
+      rx->received.insert(rx->received.end(), line.begin(), line.end());
+    }
+  }
+  if (idle) {
+    deliver(rx);
+  }
+  // end of the transmission: the "interrupt" runs before rmt_tx_wait_all_done() returns
+  if (tx_channel->done) {
+    rmt_tx_done_event_data_t event;
+    event.num_symbols = symbols.size();
+    tx_channel->done(tx_channel, &event, tx_channel->context);
+  }
+  return ESP_OK;
+}
+
+esp_err_t rmt_tx_wait_all_done(rmt_channel_handle_t tx_channel, int) {
+  // the transmission is complete and the line is idle: an armed reception ends
+  std::lock_guard<std::mutex> lock(rmtMutex);
+  deliver(receiver(tx_channel->gpio));
+  return ESP_OK;
+}
+
+// NVS: a single partition in memory
+
+static std::mutex nvsMutex;
+static std::vector<std::string> nvsNamespaces;
+static std::map<std::string, std::string> nvsEntries;
+
+esp_err_t nvs_open(const char* ns, nvs_open_mode_t, nvs_handle_t* handle) {
+  std::lock_guard<std::mutex> lock(nvsMutex);
+  for (size_t i = 0; i < nvsNamespaces.size(); i++) {
+    if (nvsNamespaces[i] == ns) {
+      *handle = i;
+      return ESP_OK;
+    }
+  }
+  nvsNamespaces.push_back(ns);
+  *handle = nvsNamespaces.size() - 1;
+  return ESP_OK;
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char* key, void* value, size_t* length) {
+  std::lock_guard<std::mutex> lock(nvsMutex);
+  const auto it = nvsEntries.find(nvsNamespaces[handle] + "/" + key);
+  if (it == nvsEntries.end()) {
+    return ESP_ERR_NVS_NOT_FOUND;
+  }
+  if (value) {
+    if (*length < it->second.size()) {
+      return ESP_FAIL;
+    }
+    memcpy(value, it->second.data(), it->second.size());
+  }
+  *length = it->second.size();
+  return ESP_OK;
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char* key, const void* value, size_t length) {
+  std::lock_guard<std::mutex> lock(nvsMutex);
+  nvsEntries[nvsNamespaces[handle] + "/" + key] = std::string(static_cast<const char*>(value), length);
+  return ESP_OK;
+}
+
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char* key) {
+  std::lock_guard<std::mutex> lock(nvsMutex);
+  return nvsEntries.erase(nvsNamespaces[handle] + "/" + key) ? ESP_OK : ESP_ERR_NVS_NOT_FOUND;
+}
+
+esp_err_t nvs_commit(nvs_handle_t) {
+  return ESP_OK;
+}
+
+void nvs_close(nvs_handle_t) {}
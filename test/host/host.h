@@ -0,0 +1,41 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) Mathieu Carbou
+ */
+#pragma once
+
+// Host build of the library (see test/CMakeLists.txt): the headers of this directory stand in for ESP-IDF,
+// FreeRTOS, the Arduino core and ArduinoJson so that the library compiles and runs on Linux.
+// - tasks are threads, queues and semaphores are built on std::mutex and std::condition_variable
+// - the clock is the host steady clock, which tests can move forward with advance()
+// - the RMT channels drive the 1-Wire devices attached to their pin slot by slot, and log the transmitted symbols
+
+#include "driver/rmt_types.h"
+
+#include <vector>
+
+namespace host {
+  // 1-Wire devices attached to a pin, driven slot by slot by the RMT stand-in
+  class SlotBus {
+    public:
+      virtual ~SlotBus() = default;
+      // reset pulse: returns true if a device answered with a presence pulse
+      virtual bool reset() = 0;
+      // bit slot started by the master: one is false for a write 0 slot (line held low),
+      // returns the level sampled by the master (false if a device pulled the line low)
+      virtual bool slot(bool one) = 0;
+  };
+
+  // attach the devices of a pin, nullptr to detach
+  void attach(uint8_t pin, SlotBus* bus);
+
+  // symbols transmitted by all the RMT channels since the last clearTransmitted()
+  std::vector<rmt_symbol_word_t> transmitted();
+  void clearTransmitted();
+
+  // move the clock forward (millis(), esp_timer_get_time(), xTaskGetTickCount())
+  void advance(uint32_t ms);
+
+  // last level set with gpio_set_level(), -1 if the pin is not an output
+  int level(uint8_t pin);
+} // namespace host
@@ -0,0 +1,18 @@
+// SPDX-License-Identifier: MIT
+// Host stand-in for ESP-IDF: an in-memory NVS partition
+#pragma once
+
+#include "esp_err.h"
+
+typedef uint32_t nvs_handle_t;
+typedef enum {
+  NVS_READONLY,
+  NVS_READWRITE
+} nvs_open_mode_t;
+
+esp_err_t nvs_open(const char* ns, nvs_open_mode_t mode, nvs_handle_t* handle);
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char* key, void* value, size_t* length);
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char* key, const void* value, size_t length);
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char* key);
+esp_err_t nvs_commit(nvs_handle_t handle);
+void nvs_close(nvs_handle_t handle);
@@ -0,0 +1,5 @@
+// SPDX-License-Identifier: MIT
+// Host stand-in for ESP-IDF: see test/host/host.h
+#pragma once
+
+#define CONFIG_IDF_TARGET_ESP32 1
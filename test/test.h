@@ -0,0 +1,65 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) Mathieu Carbou
+ */
+#pragma once
+
+#include <stdio.h>
+
+#include <functional>
+#include <vector>
+
+// Minimal test runner of the host tests: each TEST() registers a function, CHECK() records failures and continues
+
+struct TestCase {
+    const char* name;
+    std::function<void()> fn;
+};
+
+inline std::vector<TestCase>& tests() {
+  static std::vector<TestCase> all;
+  return all;
+}
+
+inline int& failures() {
+  static int count = 0;
+  return count;
+}
+
+struct TestRegistration {
+    TestRegistration(const char* name, std::function<void()> fn) { tests().push_back({name, fn}); }
+};
+
+#define TEST(name)                                               \
+  static void test_##name();                                     \
+  static TestRegistration registration_##name(#name, test_##name); \
+  static void test_##name()
+
+#define CHECK(condition)                                                        \
+  do {                                                                          \
+    if (!(condition)) {                                                         \
+      printf("  %s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition);   \
+      failures()++;                                                             \
+    }                                                                           \
+  } while (0)
+
+#define CHECK_EQ(actual, expected)                                                                   \
+  do {                                                                                               \
+    const long long a_ = static_cast<long long>(actual);                                             \
+    const long long e_ = static_cast<long long>(expected);                                           \
+    if (a_ != e_) {                                                                                  \
+      printf("  %s:%d: CHECK_EQ(%s, %s) failed: %lld != %lld\n", __FILE__, __LINE__, #actual, #expected, a_, e_); \
+      failures()++;                                                                                  \
+    }                                                                                                \
+  } while (0)
+
+// runs all the tests and returns the exit code
+inline int runTests() {
+  for (const TestCase& test : tests()) {
+    const int before = failures();
+    test.fn();
+    printf("%s %s\n", failures() == before ? "PASS" : "FAIL", test.name);
+  }
+  printf("%d failure(s)\n", failures());
+  return failures() ? 1 : 0;
+}
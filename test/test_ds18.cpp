@@ -0,0 +1,532 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) Mathieu Carbou
+ */
+#include "OneWireSimulator.h"
+#include "test.h"
+
+#include <MycilaDS18.h>
+#include <MycilaDS18Bus.h>
+#include <MycilaDS18Cache.h>
+#include <MycilaDS18Filter.h>
+
+#include <string.h>
+
+#define PIN 5
+
+static uint64_t addSensor(OneWireSimulator& sim, uint64_t serial, int16_t raw, uint8_t family = MYCILA_DS18_DS18B20) {
+  OneWireSimulator::Device device;
+  device.rom = OneWireSimulator::rom(family, serial);
+  device.temperature = raw;
+  return sim.add(device);
+}
+
+TEST(begin_searches_the_sensor) {
+  OneWireSimulator sim;
+  host::attach(PIN, &sim);
+  const uint64_t rom = addSensor(sim, 1, 22 * 16);
+  {
+    Mycila::DS18 ds18;
+    ds18.begin(PIN);
+    CHECK(ds18.isEnabled());
+    CHECK(ds18.getAddress() == rom);
+    CHECK_EQ(ds18.getResolution(), 12);
+    CHECK(!ds18.isParasite());
+    // begin() started the first conversion
+    CHECK_EQ(sim.counters().conversions, 1);
+  }
+  host::attach(PIN, nullptr);
+}
+
+TEST(begin_without_sensor) {
+  OneWireSimulator sim;
+  host::attach(PIN, &sim);
+  Mycila::DS18 ds18;
+  ds18.begin(PIN, static_cast<uint8_t>(1));
+  CHECK(!ds18.isEnabled());
+  host::attach(PIN, nullptr);
+}
+
+// memory storage counting the writes
+class CountingStorage : public Mycila::DS18MemoryStorage {
+  public:
+    bool save(const Mycila::DS18CacheEntry* entries, size_t count) override {
+      saves++;
+      return DS18MemoryStorage::save(entries, count);
+    }
+    int saves = 0;
+};
+
+TEST(cache_hit_skips_the_search) {
+  OneWireSimulator sim;
+  host::attach(PIN, &sim);
+  OneWireSimulator::Device device;
+  device.rom = OneWireSimulator::rom(MYCILA_DS18_DS18B20, 1);
+  device.resolution = 10;
+  const uint64_t rom = sim.add(device);
+  CountingStorage storage;
+  const Mycila::DS18CacheEntry entry = {rom, PIN};
+  storage.save(&entry, 1);
+  storage.saves = 0;
+  {
+    Mycila::DS18Cache cache(storage);
+    cache.begin();
+    CHECK_EQ(cache.getCount(), 1);
+    Mycila::DS18 ds18;
+    ds18.begin(PIN, cache);
+    CHECK(ds18.isEnabled());
+    CHECK(ds18.getAddress() == rom);
+    CHECK_EQ(sim.counters().searches, 0);
+    // the configuration comes from the scratchpad read validating the sensor
+    CHECK_EQ(sim.counters().scratchpadReads, 1);
+    CHECK_EQ(ds18.getResolution(), 10);
+    // unchanged: not written
+    CHECK(!cache.isDirty());
+    CHECK_EQ(storage.saves, 0);
+  }
+  host::attach(PIN, nullptr);
+}
+
+TEST(cache_stale_entry_falls_back_to_search) {
+  OneWireSimulator sim;
+  host::attach(PIN, &sim);
+  const uint64_t rom = addSensor(sim, 2, 20 * 16);
+  CountingStorage storage;
+  // replaced sensor, and a sensor of another pin
+  const Mycila::DS18CacheEntry entries[2] = {{OneWireSimulator::rom(MYCILA_DS18_DS18B20, 1), PIN}, {OneWireSimulator::rom(MYCILA_DS18_DS18B20, 3), PIN + 1}};
+  storage.save(entries, 2);
+  storage.saves = 0;
+  {
+    Mycila::DS18Cache cache(storage);
+    cache.begin();
+    Mycila::DS18 ds18;
+    ds18.begin(PIN, cache);
+    CHECK(ds18.isEnabled());
+    CHECK(ds18.getAddress() == rom);
+    CHECK(sim.counters().searches > 0);
+    CHECK(cache.find(PIN) == rom);
+    CHECK(cache.find(PIN, 1) == 0);
+    CHECK(cache.find(PIN + 1) == entries[1].address);
+    // the stale entry is removed and the found sensor added in a single write
+    CHECK_EQ(storage.saves, 1);
+    CHECK_EQ(storage.getCount(), 2);
+  }
+  host::attach(PIN, nullptr);
+}
+
+TEST(cache_commit_only_when_dirty) {
+  OneWireSimulator sim;
+  host::attach(PIN, &sim);
+  const uint64_t rom = addSensor(sim, 1, 20 * 16);
+  CountingStorage storage;
+  // first boot: searched and stored
+  {
+    Mycila::DS18Cache cache(storage);
+    cache.begin();
+    Mycila::DS18 ds18;
+    ds18.begin(PIN, cache);
+    CHECK(ds18.isEnabled());
+    CHECK_EQ(storage.saves, 1);
+    CHECK_EQ(storage.getCount(), 1);
+  }
+  // next boot: nothing written
+  sim.clearCounters();
+  {
+    Mycila::DS18Cache cache(storage);
+    cache.begin();
+    Mycila::DS18 ds18;
+    ds18.begin(PIN, cache);
+    CHECK(ds18.getAddress() == rom);
+    CHECK_EQ(sim.counters().searches, 0);
+    CHECK_EQ(storage.saves, 1);
+
+    CHECK(cache.put(PIN, rom));
+    CHECK(!cache.isDirty());
+    CHECK(cache.commit());
+    CHECK_EQ(storage.saves, 1);
+    CHECK(cache.remove(PIN, rom));
+    CHECK(cache.isDirty());
+    CHECK(cache.commit());
+    CHECK_EQ(storage.saves, 2);
+    CHECK_EQ(storage.getCount(), 0);
+    // empty cache cleared: not dirty
+    cache.clear();
+    CHECK(!cache.isDirty());
+  }
+  host::attach(PIN, nullptr);
+}
+
+TEST(read) {
+  OneWireSimulator sim;
+  host::attach(PIN, &sim);
+  const uint64_t rom = addSensor(sim, 1, 22 * 16 + 4);
+  {
+    Mycila::DS18 ds18;
+    ds18.begin(PIN);
+    int16_t notified = 0;
+    ds18.listenRaw([&notified](int16_t raw, bool changed) {
+      if (changed)
+        notified = raw;
+    });
+    host::advance(MYCILA_DS18_CONVERSION_TIME_MS);
+    CHECK(ds18.read());
+    CHECK(ds18.isValid());
+    CHECK(ds18.getTemperature().value_or(0) == 22.25f);
+    CHECK_EQ(ds18.getRawTemperature().value_or(0), 22 * 16 + 4);
+    CHECK_EQ(notified, 22 * 16 + 4);
+    CHECK_EQ(ds18.getHealth().ok, 1);
+
+    // read() requested the next conversion
+    sim.setTemperature(rom, 30 * 16);
+    host::advance(MYCILA_DS18_CONVERSION_TIME_MS);
+    CHECK(ds18.read());
+    CHECK_EQ(ds18.getRawTemperature().value_or(0), 30 * 16);
+    CHECK_EQ(notified, 30 * 16);
+  }
+  host::attach(PIN, nullptr);
+}
+
+TEST(read_errors) {
+  OneWireSimulator sim;
+  host::attach(PIN, &sim);
+  const uint64_t rom = addSensor(sim, 1, 20 * 16);
+  {
+    Mycila::DS18 ds18;
+    ds18.begin(PIN, rom);
+    host::advance(MYCILA_DS18_CONVERSION_TIME_MS);
+    CHECK(ds18.read());
+
+    sim.corrupt(rom);
+    CHECK(!ds18.read());
+    CHECK_EQ(ds18.getHealth().crc, 1);
+    CHECK_EQ(ds18.getSnapshot().result, OneWire32::Result::CRC);
+    // the last valid reading is kept
+    CHECK_EQ(ds18.getRawTemperature().value_or(0), 20 * 16);
+
+    sim.silence(1);
+    CHECK(!ds18.read());
+    CHECK_EQ(ds18.getHealth().timeout, 1);
+    CHECK_EQ(ds18.getHealth().failures, 2);
+
+    host::advance(MYCILA_DS18_CONVERSION_TIME_MS);
+    CHECK(ds18.read());
+    CHECK_EQ(ds18.getHealth().failures, 0);
+  }
+  host::attach(PIN, nullptr);
+}
+
+TEST(conversion_polling) {
+  OneWireSimulator sim;
+  host::attach(PIN, &sim);
+  addSensor(sim, 1, 20 * 16);
+  {
+    Mycila::DS18 ds18;
+    ds18.begin(PIN);
+    ds18.setConversionPolling(true);
+    CHECK(!ds18.read());
+    host::advance(MYCILA_DS18_CONVERSION_TIME_MS);
+    CHECK(ds18.read());
+    CHECK_EQ(ds18.getRawTemperature().value_or(0), 20 * 16);
+  }
+  host::attach(PIN, nullptr);
+}
+
+TEST(set_resolution) {
+  OneWireSimulator sim;
+  host::attach(PIN, &sim);
+  const uint64_t rom = addSensor(sim, 1, 20 * 16 + 1);
+  {
+    Mycila::DS18 ds18;
+    ds18.begin(PIN);
+    CHECK(ds18.setResolution(10, true));
+    CHECK_EQ(sim.getResolution(rom), 10);
+    CHECK(sim.isPersisted(rom));
+    CHECK_EQ(ds18.getConversionTime(), 188);
+    host::advance(188);
+    CHECK(ds18.read());
+    // 10 bits: 0.25 °C
+    CHECK_EQ(ds18.getRawTemperature().value_or(0), 20 * 16);
+  }
+  host::attach(PIN, nullptr);
+}
+
+TEST(ds18s20) {
+  OneWireSimulator sim;
+  host::attach(PIN, &sim);
+  addSensor(sim, 1, 20 * 16 + 3, MYCILA_DS18_DS18S20);
+  {
+    Mycila::DS18 ds18;
+    ds18.begin(PIN);
+    CHECK(ds18.isEnabled());
+    CHECK(!strcmp(ds18.getModel(), "DS18S20"));
+    CHECK(!ds18.setResolution(10));
+    host::advance(MYCILA_DS18_CONVERSION_TIME_MS);
+    CHECK(ds18.read());
+    CHECK_EQ(ds18.getRawTemperature().value_or(0), 20 * 16 + 3);
+    // fast reads decode the same extended resolution
+    ds18.setFastRead(4);
+    host::advance(MYCILA_DS18_CONVERSION_TIME_MS);
+    CHECK(ds18.read());
+    CHECK_EQ(ds18.getRawTemperature().value_or(0), 20 * 16 + 3);
+  }
+  host::attach(PIN, nullptr);
+}
+
+TEST(bus) {
+  OneWireSimulator sim;
+  host::attach(PIN, &sim);
+  const uint64_t roms[3] = {addSensor(sim, 1, 10 * 16), addSensor(sim, 2, 20 * 16), addSensor(sim, 3, 30 * 16)};
+  {
+    Mycila::DS18Bus bus;
+    bus.begin(PIN);
+    CHECK(bus.isEnabled());
+    Mycila::DS18 sensors[3];
+    for (size_t i = 0; i < 3; i++) {
+      sensors[i].begin(bus.getOneWire(), PIN, roms[i]);
+      CHECK(bus.add(sensors[i]));
+    }
+    CHECK_EQ(bus.read(), 0);
+    host::advance(MYCILA_DS18_CONVERSION_TIME_MS);
+    CHECK_EQ(bus.read(), 3);
+    for (size_t i = 0; i < 3; i++)
+      CHECK_EQ(sensors[i].getRawTemperature().value_or(0), (i + 1) * 10 * 16);
+
+    // hot-plug
+    const uint64_t plugged = addSensor(sim, 4, 0);
+    sim.remove(roms[1]);
+    uint64_t added = 0;
+    uint64_t removed = 0;
+    CHECK(bus.scan([&](uint64_t address, bool isAdded) {
+      if (isAdded)
+        added = address;
+      else
+        removed = address;
+    }));
+    CHECK(added == plugged);
+    CHECK(removed == roms[1]);
+
+    bus.end();
+    CHECK(!sensors[0].isEnabled());
+  }
+  host::attach(PIN, nullptr);
+}
+
+TEST(multi_bus_does_not_count_filtered_readings) {
+  OneWireSimulator sim;
+  host::attach(PIN, &sim);
+  const uint64_t roms[2] = {addSensor(sim, 1, 20 * 16), addSensor(sim, 2, 85 * 16)};
+  {
+    Mycila::DS18Bus bus;
+    bus.begin(PIN);
+    Mycila::DS18 sensors[2];
+    Mycila::DS18Filter filter;
+    filter.setPowerOnRejection(true);
+    for (size_t i = 0; i < 2; i++) {
+      sensors[i].begin(bus.getOneWire(), PIN, roms[i]);
+      CHECK(bus.add(sensors[i]));
+    }
+    sensors[1].setFilter(&filter);
+    Mycila::DS18MultiBus multiBus;
+    CHECK(multiBus.add(bus));
+    // both scratchpads are read, but the power-on value is rejected by the filter
+    CHECK_EQ(multiBus.read(), 1);
+    CHECK_EQ(sensors[0].getRawTemperature().value_or(0), 20 * 16);
+    CHECK(!sensors[1].getRawTemperature().has_value());
+    CHECK_EQ(sensors[1].getHealth().ok, 1);
+    CHECK_EQ(sensors[1].getHealth().filtered, 1);
+  }
+  host::attach(PIN, nullptr);
+}
+
+// calls read() every 10 ms until it succeeds: returns the time waited in milliseconds
+static uint32_t waitRead(Mycila::DS18& ds18) {
+  for (uint32_t waited = 0; waited < 100000; waited += 10) {
+    if (ds18.read())
+      return waited;
+    host::advance(10);
+  }
+  return UINT32_MAX;
+}
+
+#define CHECK_WAITED(wait, interval)                  \
+  do {                                               \
+    const uint32_t waited_ = (wait);                 \
+    CHECK(waited_ >= (interval));                    \
+    CHECK(waited_ < (interval) + 20);                \
+  } while (0)
+
+TEST(adaptive_polling_doubles_up_to_the_maximum) {
+  OneWireSimulator sim;
+  host::attach(PIN, &sim);
+  addSensor(sim, 1, 20 * 16);
+  {
+    Mycila::DS18 ds18;
+    ds18.begin(PIN);
+    CHECK_EQ(ds18.getPollingInterval(), 0);
+    ds18.setAdaptivePolling(1000, 8000);
+    CHECK_EQ(ds18.getPollingInterval(), 1000);
+    // conversion started by begin()
+    CHECK(waitRead(ds18) <= MYCILA_DS18_CONVERSION_TIME_MS);
+    CHECK_EQ(ds18.getPollingInterval(), 1000);
+    // stable temperature
+    const uint32_t intervals[] = {1000, 2000, 4000, 8000, 8000};
+    for (size_t i = 0; i < 5; i++) {
+      CHECK_WAITED(waitRead(ds18), intervals[i]);
+      CHECK_EQ(ds18.getPollingInterval(), i < 4 ? intervals[i + 1] : 8000);
+    }
+  }
+  host::attach(PIN, nullptr);
+}
+
+TEST(adaptive_polling_resets_on_change_and_failure) {
+  OneWireSimulator sim;
+  host::attach(PIN, &sim);
+  const uint64_t rom = addSensor(sim, 1, 20 * 16);
+  {
+    Mycila::DS18 ds18;
+    ds18.begin(PIN);
+    ds18.setAdaptivePolling(1000, 8000);
+    waitRead(ds18);
+    waitRead(ds18);
+    waitRead(ds18);
+    CHECK_EQ(ds18.getPollingInterval(), 4000);
+
+    // more than half the threshold (4): kept
+    sim.setTemperature(rom, 20 * 16 + 3);
+    CHECK_WAITED(waitRead(ds18), 4000);
+    CHECK_EQ(ds18.getPollingInterval(), 4000);
+
+    // more than the threshold: back to the minimum
+    sim.setTemperature(rom, 21 * 16);
+    CHECK_WAITED(waitRead(ds18), 4000);
+    CHECK_EQ(ds18.getPollingInterval(), 1000);
+
+    CHECK_WAITED(waitRead(ds18), 1000);
+    CHECK_EQ(ds18.getPollingInterval(), 2000);
+
+    // failed read: retried at the minimum interval
+    sim.corrupt(rom);
+    host::advance(2000 - MYCILA_DS18_CONVERSION_TIME_MS);
+    CHECK(!ds18.read());
+    host::advance(MYCILA_DS18_CONVERSION_TIME_MS);
+    CHECK(!ds18.read());
+    CHECK_EQ(ds18.getHealth().crc, 1);
+    CHECK_EQ(ds18.getPollingInterval(), 1000);
+    CHECK_WAITED(waitRead(ds18), 1000);
+  }
+  host::attach(PIN, nullptr);
+}
+
+TEST(adaptive_polling_capped_by_the_expiration_delay) {
+  OneWireSimulator sim;
+  host::attach(PIN, &sim);
+  addSensor(sim, 1, 20 * 16);
+  {
+    Mycila::DS18 ds18;
+    ds18.begin(PIN);
+    ds18.setExpirationDelay(5);
+    ds18.setAdaptivePolling(1000, 60000);
+    waitRead(ds18);
+    CHECK_WAITED(waitRead(ds18), 1000);
+    CHECK_EQ(ds18.getPollingInterval(), 2000);
+    CHECK_WAITED(waitRead(ds18), 2000);
+    // half the expiration delay
+    CHECK_EQ(ds18.getPollingInterval(), 2500);
+    CHECK_WAITED(waitRead(ds18), 2500);
+    CHECK_EQ(ds18.getPollingInterval(), 2500);
+    CHECK(ds18.getTemperature().has_value());
+  }
+  host::attach(PIN, nullptr);
+}
+
+TEST(adaptive_polling_just_in_time_conversion) {
+  OneWireSimulator sim;
+  host::attach(PIN, &sim);
+  const uint64_t rom = addSensor(sim, 1, 20 * 16);
+  {
+    Mycila::DS18 ds18;
+    ds18.begin(PIN);
+    ds18.setAdaptivePolling(2000, 2000);
+    waitRead(ds18);
+    const uint32_t conversions = sim.counters().conversions;
+    // no conversion is requested after the read
+    CHECK_EQ(conversions, 1);
+
+    sim.setTemperature(rom, 25 * 16);
+    host::advance(2000 - MYCILA_DS18_CONVERSION_TIME_MS - 10);
+    CHECK(!ds18.read());
+    CHECK_EQ(sim.counters().conversions, conversions);
+    // the conversion completes when the sensor is due
+    host::advance(10);
+    CHECK(!ds18.read());
+    CHECK_EQ(sim.counters().conversions, conversions + 1);
+    host::advance(MYCILA_DS18_CONVERSION_TIME_MS - 10);
+    CHECK(!ds18.read());
+    host::advance(10);
+    CHECK(ds18.read());
+    // fresh reading
+    CHECK_EQ(ds18.getRawTemperature().value_or(0), 25 * 16);
+    CHECK_EQ(sim.counters().conversions, conversions + 1);
+  }
+  host::attach(PIN, nullptr);
+}
+
+TEST(threshold) {
+  Mycila::DS18 ds18;
+  // the value set by the user is kept, the comparison is done in 1/16 °C
+  CHECK(ds18.getThreshold() == MYCILA_DS18_RELEVANT_TEMPERATURE_CHANGE);
+  CHECK_EQ(ds18.getRawThreshold(), 4);
+  ds18.setThreshold(0.3f);
+  CHECK(ds18.getThreshold() == 0.3f);
+  CHECK_EQ(ds18.getRawThreshold(), 4);
+  ds18.setThreshold(5000);
+  CHECK(ds18.getThreshold() == 5000);
+  CHECK_EQ(ds18.getRawThreshold(), INT16_MAX);
+  ds18.setThreshold(-5000);
+  CHECK_EQ(ds18.getRawThreshold(), INT16_MIN);
+  ds18.setRawThreshold(8);
+  CHECK(ds18.getThreshold() == 0.5f);
+}
+
+TEST(read_async) {
+  OneWireSimulator sim;
+  host::attach(PIN, &sim);
+  addSensor(sim, 1, 25 * 16);
+  {
+    Mycila::DS18 ds18;
+    ds18.begin(PIN);
+    host::advance(MYCILA_DS18_CONVERSION_TIME_MS);
+    CHECK(ds18.readAsync());
+    // the read completes in the engine task
+    for (int i = 0; i < 100 && !ds18.isValid(); i++)
+      delay(1);
+    CHECK_EQ(ds18.getRawTemperature().value_or(0), 25 * 16);
+  }
+  host::attach(PIN, nullptr);
+}
+
+TEST(task) {
+  OneWireSimulator sim;
+  host::attach(PIN, &sim);
+  OneWireSimulator::Device device;
+  device.rom = OneWireSimulator::rom(MYCILA_DS18_DS18B20, 1);
+  device.temperature = 18 * 16;
+  device.conversionTime = 1;
+  sim.add(device);
+  {
+    Mycila::DS18 ds18;
+    ds18.begin(PIN);
+    delay(2);
+    CHECK(ds18.startTask(10));
+    for (int i = 0; i < 100 && !ds18.isValid(); i++)
+      delay(1);
+    CHECK_EQ(ds18.getRawTemperature().value_or(0), 18 * 16);
+    ds18.stopTask();
+    CHECK(!ds18.isTaskRunning());
+  }
+  host::attach(PIN, nullptr);
+}
+
+int main() {
+  return runTests();
+}
@@ -0,0 +1,68 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) Mathieu Carbou
+ */
+#include "test.h"
+
+#include <MycilaDS18Filter.h>
+
+// poll period of a 12-bit sensor
+#define PERIOD 750
+
+TEST(slew_rate_slower_than_the_poll_period) {
+  Mycila::DS18Filter filter;
+  // 1/16 °C per second: less than one step per reading
+  filter.setSlewRate(1);
+  int16_t raw = 400;
+  CHECK(filter.apply(raw, 0));
+  CHECK_EQ(raw, 400);
+  for (uint32_t i = 1; i <= 40; i++) {
+    raw = 490;
+    CHECK(filter.apply(raw, i * PERIOD));
+    // the output keeps moving at the configured rate
+    CHECK_EQ(raw, 400 + i * PERIOD / 1000);
+  }
+}
+
+TEST(slew_rate_not_a_multiple_of_the_poll_period) {
+  Mycila::DS18Filter filter;
+  filter.setSlewRate(2);
+  int16_t raw = 400;
+  CHECK(filter.apply(raw, 0));
+  for (uint32_t i = 1; i <= 40; i++) {
+    raw = 300;
+    CHECK(filter.apply(raw, i * PERIOD));
+    CHECK_EQ(raw, 400 - 2 * i * PERIOD / 1000);
+  }
+  // 2/s over 30 s
+  CHECK_EQ(raw, 340);
+}
+
+TEST(slew_rate_reached_target) {
+  Mycila::DS18Filter filter;
+  filter.setSlewRate(16);
+  int16_t raw = 400;
+  CHECK(filter.apply(raw, 0));
+  raw = 410;
+  CHECK(filter.apply(raw, PERIOD));
+  CHECK_EQ(raw, 410);
+  // no budget is carried over once the output follows the input
+  raw = 500;
+  CHECK(filter.apply(raw, 2 * PERIOD));
+  CHECK_EQ(raw, 422);
+}
+
+TEST(slew_rate_long_gap) {
+  Mycila::DS18Filter filter;
+  filter.setSlewRate(1);
+  int16_t raw = 400;
+  CHECK(filter.apply(raw, 0));
+  // more than 24 days: the budget does not overflow
+  raw = 1000;
+  CHECK(filter.apply(raw, 0xF0000000));
+  CHECK_EQ(raw, 1000);
+}
+
+int main() {
+  return runTests();
+}
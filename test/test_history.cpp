@@ -0,0 +1,174 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) Mathieu Carbou
+ */
+#include "test.h"
+
+#include <MycilaDS18History.h>
+
+typedef Mycila::DS18History<4> History4;
+typedef Mycila::DS18History<8> History8;
+
+TEST(ring_buffer_overwrite) {
+  History4 history;
+  // both windows (1 minute and 1 hour) are longer than the 4 readings kept
+  for (int16_t i = 1; i <= 10; i++)
+    history.add(i * 16, i * 1000);
+  CHECK_EQ(history.size(), 4);
+  for (size_t w = 0; w < 2; w++) {
+    const History4::Aggregate aggregate = history.getAggregate(w);
+    // only the readings still kept: 7 to 10
+    CHECK_EQ(aggregate.count, 4);
+    CHECK_EQ(aggregate.start, 7000);
+    CHECK_EQ(aggregate.min, 7 * 16);
+    CHECK_EQ(aggregate.max, 10 * 16);
+    CHECK_EQ(aggregate.sum, (7 + 8 + 9 + 10) * 16);
+    CHECK_EQ(aggregate.mean(), 8 * 16 + 8);
+  }
+  // the overwritten readings were the min: rescanned
+  history.add(0, 11000);
+  CHECK_EQ(history.getAggregate(0).min, 0);
+  CHECK_EQ(history.getAggregate(0).max, 10 * 16);
+  history.add(5 * 16, 12000);
+  history.add(5 * 16, 13000);
+  history.add(5 * 16, 14000);
+  // 10 expired
+  CHECK_EQ(history.getAggregate(1).max, 5 * 16);
+  CHECK_EQ(history.getAggregate(1).min, 0);
+
+  history.clear();
+  CHECK_EQ(history.size(), 0);
+  CHECK_EQ(history.getAggregate(0).count, 0);
+}
+
+TEST(min_max_expiry) {
+  History8 history;
+  history.setWindow(0, 10);
+  history.setWindow(1, 0);
+  history.add(100, 0);
+  history.add(50, 1000);
+  history.add(60, 2000);
+  history.add(40, 3000);
+  History8::Aggregate aggregate = history.getAggregate(0);
+  CHECK_EQ(aggregate.count, 4);
+  CHECK_EQ(aggregate.min, 40);
+  CHECK_EQ(aggregate.max, 100);
+  // disabled window
+  CHECK_EQ(history.getAggregate(1).count, 0);
+
+  // the max is 10 s old: expired
+  history.add(70, 10000);
+  aggregate = history.getAggregate(0);
+  CHECK_EQ(aggregate.count, 4);
+  CHECK_EQ(aggregate.start, 1000);
+  CHECK_EQ(aggregate.max, 70);
+  CHECK_EQ(aggregate.min, 40);
+  CHECK_EQ(aggregate.sum, 50 + 60 + 40 + 70);
+
+  // the min expires too
+  history.add(65, 13000);
+  aggregate = history.getAggregate(0);
+  CHECK_EQ(aggregate.count, 2);
+  CHECK_EQ(aggregate.start, 10000);
+  CHECK_EQ(aggregate.min, 65);
+  CHECK_EQ(aggregate.max, 70);
+  CHECK_EQ(aggregate.mean(), 67);
+
+  // a long gap: only the last reading is left
+  history.add(-20, 60000);
+  aggregate = history.getAggregate(0);
+  CHECK_EQ(aggregate.count, 1);
+  CHECK_EQ(aggregate.min, -20);
+  CHECK_EQ(aggregate.max, -20);
+  CHECK_EQ(aggregate.mean(), -20);
+  // all the readings are still in the ring buffer
+  CHECK_EQ(history.size(), 7);
+}
+
+TEST(set_window_rebuilds_the_aggregate) {
+  History8 history;
+  for (int16_t i = 0; i < 6; i++)
+    history.add(i % 2 ? 10 * i : -10 * i, i * 1000);
+  // readings less than 3 s before the last one (5 s): 3, 4 and 5 s
+  history.setWindow(0, 3);
+  History8::Aggregate aggregate = history.getAggregate(0);
+  CHECK_EQ(aggregate.count, 3);
+  CHECK_EQ(aggregate.start, 3000);
+  CHECK_EQ(aggregate.min, -40);
+  CHECK_EQ(aggregate.max, 50);
+  CHECK_EQ(aggregate.sum, 30 - 40 + 50);
+  // and keeps rolling
+  history.add(0, 6000);
+  aggregate = history.getAggregate(0);
+  CHECK_EQ(aggregate.count, 3);
+  CHECK_EQ(aggregate.min, -40);
+  CHECK_EQ(aggregate.max, 50);
+  CHECK_EQ(aggregate.sum, -40 + 50 + 0);
+  history.add(0, 7000);
+  aggregate = history.getAggregate(0);
+  CHECK_EQ(aggregate.min, 0);
+  CHECK_EQ(aggregate.max, 50);
+  CHECK_EQ(history.getWindow(0), 3);
+}
+
+TEST(query_ranges) {
+  History8 history;
+  for (int16_t i = 0; i < 12; i++)
+    history.add(i, i * 1000);
+  History8::Sample samples[8];
+  // readings 4 to 11 are kept
+  CHECK_EQ(history.query(0, 20000, samples, 8), 8);
+  CHECK_EQ(samples[0].raw, 4);
+  CHECK_EQ(samples[7].raw, 11);
+  // inclusive bounds, oldest first
+  CHECK_EQ(history.query(5000, 7000, samples, 8), 3);
+  CHECK_EQ(samples[0].raw, 5);
+  CHECK_EQ(samples[2].raw, 7);
+  CHECK_EQ(history.query(5500, 5600, samples, 8), 0);
+  // overwritten readings
+  CHECK_EQ(history.query(0, 3000, samples, 8), 0);
+  // limited by the buffer of the caller
+  CHECK_EQ(history.query(0, 20000, samples, 2), 2);
+  CHECK_EQ(samples[1].raw, 5);
+}
+
+TEST(query_across_the_clock_wrap) {
+  History8 history;
+  const uint32_t start = 0xFFFFFFFF - 2500;
+  for (int16_t i = 0; i < 6; i++)
+    history.add(i, start + i * 1000);
+  History8::Sample samples[8];
+  CHECK_EQ(history.query(start + 1000, start + 4000, samples, 8), 4);
+  CHECK_EQ(samples[0].raw, 1);
+  CHECK_EQ(samples[3].raw, 4);
+  // the 1 minute window covers the wrap
+  CHECK_EQ(history.getAggregate(0).count, 6);
+}
+
+TEST(to_json) {
+  History4 history;
+  history.setWindow(1, 0);
+  for (int16_t i = 1; i <= 6; i++)
+    history.add(i * 8, i * 1000);
+  JsonDocument doc;
+  history.toJson(doc.to<JsonObject>());
+  const JsonArray samples = doc["samples"].as<JsonArray>();
+  CHECK_EQ(samples.size(), 4);
+  CHECK_EQ(samples[0][static_cast<size_t>(0)].as<uint32_t>(), 3000);
+  CHECK(samples[0][1].as<float>() == 1.5f);
+  CHECK(samples[3][1].as<float>() == 3.0f);
+  const JsonArray windows = doc["windows"].as<JsonArray>();
+  CHECK_EQ(windows.size(), 2);
+  CHECK_EQ(windows[0]["duration"].as<uint32_t>(), 60);
+  CHECK_EQ(windows[0]["start"].as<uint32_t>(), 3000);
+  CHECK_EQ(windows[0]["count"].as<uint32_t>(), 4);
+  CHECK(windows[0]["min"].as<float>() == 1.5f);
+  CHECK(windows[0]["max"].as<float>() == 3.0f);
+  CHECK(windows[0]["mean"].as<float>() == 2.25f);
+  CHECK_EQ(windows[1]["duration"].as<uint32_t>(), 0);
+  CHECK_EQ(windows[1]["count"].as<uint32_t>(), 0);
+}
+
+int main() {
+  return runTests();
+}
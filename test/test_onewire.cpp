@@ -0,0 +1,391 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) Mathieu Carbou
+ */
+#include "OneWireSimulator.h"
+#include "test.h"
+
+#include "esp32-ds18b20/OneWireESP32.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <memory>
+
+#define PIN 4
+
+// each test runs on both paths: the RMT channels driving the simulator slot by slot, and the simulator as transport
+static void onBothPaths(const std::function<void(OneWireSimulator& sim, OneWire32& ow)>& fn) {
+  {
+    OneWireSimulator sim;
+    host::attach(PIN, &sim);
+    OneWire32 ow(PIN);
+    fn(sim, ow);
+    host::attach(PIN, nullptr);
+  }
+  {
+    OneWireSimulator sim;
+    OneWire32 ow(&sim);
+    fn(sim, ow);
+  }
+}
+
+static std::vector<uint64_t> populate(OneWireSimulator& sim, size_t count, uint8_t family = 0x28) {
+  std::vector<uint64_t> roms;
+  for (size_t i = 0; i < count; i++) {
+    OneWireSimulator::Device device;
+    // serials sharing prefixes, so that the search walks many discrepancies
+    device.rom = OneWireSimulator::rom(family, 0x5A0000 + i * 0x1041);
+    device.temperature = 400 + i;
+    roms.push_back(sim.add(device));
+  }
+  return roms;
+}
+
+static void convert(OneWire32& ow) {
+  ow.request();
+  host::advance(750);
+}
+
+TEST(search_finds_all_devices) {
+  onBothPaths([](OneWireSimulator& sim, OneWire32& ow) {
+    std::vector<uint64_t> roms = populate(sim, 8);
+    uint64_t found[16];
+    CHECK_EQ(ow.search(found, 16), 8);
+    std::vector<uint64_t> sorted(found, found + 8);
+    std::sort(sorted.begin(), sorted.end());
+    std::sort(roms.begin(), roms.end());
+    CHECK(sorted == roms);
+  });
+}
+
+TEST(search_by_family) {
+  onBothPaths([](OneWireSimulator& sim, OneWire32& ow) {
+    populate(sim, 3, 0x28);
+    std::vector<uint64_t> others = populate(sim, 2, 0x10);
+    uint64_t found[8];
+    CHECK_EQ(ow.search(found, 8, 0x10), 2);
+    CHECK((found[0] == others[0] && found[1] == others[1]) || (found[0] == others[1] && found[1] == others[0]));
+    CHECK_EQ(ow.search(found, 8, 0x22), 0);
+  });
+}
+
+TEST(search_empty_bus) {
+  onBothPaths([](OneWireSimulator&, OneWire32& ow) {
+    uint64_t found[4];
+    CHECK_EQ(ow.search(found, 4), 0);
+    CHECK(!ow.reset());
+  });
+}
+
+TEST(alarm_search_finds_flagged_devices) {
+  onBothPaths([](OneWireSimulator& sim, OneWire32& ow) {
+    std::vector<uint64_t> roms = populate(sim, 4);
+    // TH = 60 °C, TL = -10 °C
+    const uint8_t thresholds[2] = {60, static_cast<uint8_t>(-10)};
+    for (uint64_t rom : roms)
+      CHECK(ow.writeScratchpad(rom, thresholds, 2));
+    sim.setTemperature(roms[2], 90 * 16);
+    convert(ow);
+    OneWire32::Search search;
+    search.cmd = 0xEC;
+    uint64_t addr = 0;
+    CHECK(ow.next(search, addr));
+    CHECK(addr == roms[2]);
+    CHECK(!ow.next(search, addr));
+    CHECK(!search.failed);
+  });
+}
+
+TEST(get_temp) {
+  onBothPaths([](OneWireSimulator& sim, OneWire32& ow) {
+    std::vector<uint64_t> roms = populate(sim, 2);
+    float temp = 0;
+    // power-on value before the first conversion
+    CHECK_EQ(ow.getTemp(roms[0], temp), OneWire32::Result::OK);
+    CHECK(temp == 85.0f);
+    sim.setTemperature(roms[1], -10 * 16 - 8);
+    convert(ow);
+    CHECK_EQ(ow.getTemp(roms[0], temp), OneWire32::Result::OK);
+    CHECK(temp == 400 / 16.0f);
+    CHECK_EQ(ow.getTemp(roms[1], temp), OneWire32::Result::OK);
+    CHECK(temp == -10.5f);
+  });
+}
+
+TEST(get_temp_resolution) {
+  onBothPaths([](OneWireSimulator& sim, OneWire32& ow) {
+    OneWireSimulator::Device device;
+    device.rom = OneWireSimulator::rom(0x28, 1);
+    device.resolution = 9;
+    device.temperature = 0x0197;
+    uint64_t rom = sim.add(device);
+    convert(ow);
+    float temp = 0;
+    CHECK_EQ(ow.getTemp(rom, temp), OneWire32::Result::OK);
+    CHECK(temp == 0x0190 / 16.0f);
+    int16_t raw = 0;
+    CHECK_EQ(ow.getTempFast(rom, raw, 9), OneWire32::Result::OK);
+    CHECK_EQ(raw, 0x0190);
+  });
+}
+
+TEST(get_temp_fast_ds18s20) {
+  onBothPaths([](OneWireSimulator& sim, OneWire32& ow) {
+    OneWireSimulator::Device device;
+    device.rom = OneWireSimulator::rom(0x10, 1);
+    device.temperature = 0x0193;
+    uint64_t rom = sim.add(device);
+    int16_t raw = 0;
+    // 85 °C power-on value
+    CHECK_EQ(ow.getTempFast(rom, raw), OneWire32::Result::BAD_DATA);
+    convert(ow);
+    uint8_t data[9];
+    CHECK_EQ(ow.readScratchpad(rom, data), OneWire32::Result::OK);
+    CHECK_EQ(OneWire32::decode10(data), 0x0193);
+    CHECK_EQ(ow.getTempFast(rom, raw), OneWire32::Result::OK);
+    CHECK_EQ(raw, 0x0193);
+  });
+}
+
+TEST(crc_injection) {
+  onBothPaths([](OneWireSimulator& sim, OneWire32& ow) {
+    std::vector<uint64_t> roms = populate(sim, 1);
+    sim.corrupt(roms[0], 1);
+    uint8_t data[9];
+    CHECK_EQ(ow.readScratchpad(roms[0], data), OneWire32::Result::CRC);
+    CHECK_EQ(ow.readScratchpad(roms[0], data), OneWire32::Result::OK);
+  });
+}
+
+TEST(timeout_injection) {
+  onBothPaths([](OneWireSimulator& sim, OneWire32& ow) {
+    std::vector<uint64_t> roms = populate(sim, 1);
+    sim.silence(1);
+    float temp;
+    CHECK_EQ(ow.getTemp(roms[0], temp), OneWire32::Result::TIMEOUT);
+    CHECK_EQ(ow.health().absent, 1);
+    CHECK_EQ(ow.getTemp(roms[0], temp), OneWire32::Result::OK);
+  });
+}
+
+TEST(hot_plug) {
+  onBothPaths([](OneWireSimulator& sim, OneWire32& ow) {
+    std::vector<uint64_t> roms = populate(sim, 3);
+    OneWireSimulator::Device device;
+    device.rom = OneWireSimulator::rom(0x28, 0xABCDEF);
+    const uint64_t plugged = sim.add(device);
+    sim.remove(roms[1]);
+    std::vector<std::pair<uint64_t, bool>> changes;
+    CHECK(ow.diff(roms.data(), roms.size(), [](uint64_t addr, bool added, void* arg) { static_cast<std::vector<std::pair<uint64_t, bool>>*>(arg)->push_back({addr, added}); }, &changes));
+    CHECK_EQ(changes.size(), 2);
+    CHECK(changes.size() == 2 && changes[0] == std::make_pair(plugged, true));
+    CHECK(changes.size() == 2 && changes[1] == std::make_pair(roms[1], false));
+  });
+}
+
+TEST(poll_conversion) {
+  onBothPaths([](OneWireSimulator& sim, OneWire32& ow) {
+    OneWireSimulator::Device device;
+    device.rom = OneWireSimulator::rom(0x28, 1);
+    device.conversionTime = 200;
+    sim.add(device);
+    bool done = true;
+    ow.request();
+    CHECK(ow.poll(done));
+    CHECK(!done);
+    host::advance(200);
+    CHECK(ow.poll(done));
+    CHECK(done);
+  });
+}
+
+TEST(read_power_supply) {
+  onBothPaths([](OneWireSimulator& sim, OneWire32& ow) {
+    std::vector<uint64_t> roms = populate(sim, 2);
+    bool parasite = true;
+    CHECK(ow.readPowerSupply(parasite));
+    CHECK(!parasite);
+    OneWireSimulator::Device device;
+    device.rom = OneWireSimulator::rom(0x28, 0x77);
+    device.parasite = true;
+    const uint64_t rom = sim.add(device);
+    CHECK(ow.readPowerSupply(parasite));
+    CHECK(parasite);
+    CHECK(ow.readPowerSupply(roms[0], parasite));
+    CHECK(!parasite);
+    CHECK(ow.readPowerSupply(rom, parasite));
+    CHECK(parasite);
+  });
+}
+
+TEST(write_and_copy_scratchpad) {
+  onBothPaths([](OneWireSimulator& sim, OneWire32& ow) {
+    std::vector<uint64_t> roms = populate(sim, 1);
+    const uint8_t config[3] = {30, 10, 0x3F};
+    CHECK(ow.writeScratchpad(roms[0], config, 3));
+    CHECK_EQ(sim.getResolution(roms[0]), 10);
+    CHECK(!sim.isPersisted(roms[0]));
+    CHECK(ow.copyScratchpad(roms[0]));
+    CHECK(sim.isPersisted(roms[0]));
+    uint8_t data[9];
+    CHECK_EQ(ow.readScratchpad(roms[0], data), OneWire32::Result::OK);
+    CHECK_EQ(data[2], 30);
+    CHECK_EQ(data[3], 10);
+    CHECK_EQ(data[4], 0x3F);
+  });
+}
+
+TEST(transaction) {
+  onBothPaths([](OneWireSimulator& sim, OneWire32& ow) {
+    std::vector<uint64_t> roms = populate(sim, 1);
+    convert(ow);
+    uint8_t frame[10];
+    frame[0] = 0x55;
+    memcpy(frame + 1, &roms[0], 8);
+    frame[9] = 0xBE;
+    uint8_t data[9] = {};
+    bool called = false;
+    OneWire32::Transaction tx;
+    tx.reset().write(frame, sizeof(frame)).read(data, sizeof(data));
+    tx.onComplete([](OneWire32::Transaction&, void* arg) { *static_cast<bool*>(arg) = true; }, &called);
+    CHECK(ow.submit(tx));
+    CHECK(ow.wait(tx));
+    CHECK(called);
+    CHECK(!tx.pending());
+    CHECK_EQ(tx.result(), OneWire32::Result::OK);
+    CHECK_EQ(OneWire32::checkScratchpad(data), OneWire32::Result::OK);
+    CHECK_EQ(OneWire32::decode12(data), 400);
+
+    // more than OW_MAX_STEPS steps
+    tx.clear();
+    for (uint8_t i = 0; i <= OW_MAX_STEPS; i++)
+      tx.reset();
+    CHECK(!ow.submit(tx));
+  });
+}
+
+// GPIO of the strong pull-up P-MOSFET
+#define SPU_PIN 21
+
+TEST(strong_pullup) {
+  onBothPaths([](OneWireSimulator& sim, OneWire32& ow) {
+    std::vector<uint64_t> roms = populate(sim, 1);
+    CHECK(ow.setStrongPullup(SPU_PIN));
+    // active low: released
+    CHECK_EQ(host::level(SPU_PIN), 1);
+
+    // externally powered bus
+    ow.request();
+    CHECK_EQ(host::level(SPU_PIN), 1);
+
+    CHECK(ow.setParasite(true));
+    ow.request();
+    // engaged at the end of Convert T, and kept until the next reset
+    CHECK_EQ(host::level(SPU_PIN), 0);
+    bool done;
+    CHECK(!ow.poll(done));
+    CHECK_EQ(host::level(SPU_PIN), 0);
+    host::advance(750);
+    float temp;
+    CHECK_EQ(ow.getTemp(roms[0], temp), OneWire32::Result::OK);
+    CHECK_EQ(host::level(SPU_PIN), 1);
+
+    // released after the EEPROM write time
+    CHECK(ow.copyScratchpad(roms[0]));
+    CHECK_EQ(host::level(SPU_PIN), 1);
+
+    // Read Scratchpad does not engage it
+    uint8_t data[9];
+    CHECK_EQ(ow.readScratchpad(roms[0], data), OneWire32::Result::OK);
+    CHECK_EQ(host::level(SPU_PIN), 1);
+
+    // asynchronous Skip ROM + Convert T
+    const uint8_t frame[2] = {0xCC, 0x44};
+    OneWire32::Transaction tx;
+    tx.reset().write(frame, sizeof(frame), true);
+    CHECK(ow.submit(tx));
+    CHECK(ow.wait(tx));
+    CHECK_EQ(tx.result(), OneWire32::Result::OK);
+    CHECK_EQ(host::level(SPU_PIN), 0);
+    CHECK(ow.reset());
+    CHECK_EQ(host::level(SPU_PIN), 1);
+
+    // active high
+    CHECK(ow.setStrongPullup(SPU_PIN, false));
+    CHECK_EQ(host::level(SPU_PIN), 0);
+    ow.request();
+    CHECK_EQ(host::level(SPU_PIN), 1);
+    CHECK(ow.reset());
+    CHECK_EQ(host::level(SPU_PIN), 0);
+  });
+  // released by the destructor
+  CHECK_EQ(host::level(SPU_PIN), -1);
+}
+
+static std::vector<uint32_t> transmitted() {
+  std::vector<uint32_t> values;
+  for (const rmt_symbol_word_t& symbol : host::transmitted())
+    values.push_back(symbol.val);
+  return values;
+}
+
+// command() and writeBytes() send whole frames with the bytes encoder: the symbols must be the same as byte per byte
+TEST(frames_match_byte_writes) {
+  OneWireSimulator sim;
+  host::attach(PIN, &sim);
+  {
+    OneWire32 ow(PIN);
+    const uint64_t rom = populate(sim, 1)[0];
+    const uint8_t* r = reinterpret_cast<const uint8_t*>(&rom);
+
+    host::clearTransmitted();
+    CHECK(ow.command(rom, 0xBE));
+    const std::vector<uint32_t> frame = transmitted();
+
+    host::clearTransmitted();
+    CHECK(ow.reset());
+    CHECK(ow.write(0x55));
+    for (uint8_t i = 0; i < 8; i++)
+      CHECK(ow.write(r[i]));
+    CHECK(ow.write(0xBE));
+    const std::vector<uint32_t> bytes = transmitted();
+
+    // reset + 10 bytes
+    CHECK_EQ(frame.size(), 1 + 10 * 8);
+    CHECK(frame == bytes);
+
+    host::clearTransmitted();
+    CHECK(ow.command(0x44));
+    const std::vector<uint32_t> skip = transmitted();
+    host::clearTransmitted();
+    CHECK(ow.reset());
+    CHECK(ow.write(0xCC));
+    CHECK(ow.write(0x44));
+    CHECK(skip == transmitted());
+
+    // every byte value, LSB first, also against the bit per bit path
+    uint8_t all[256];
+    for (int i = 0; i < 256; i++)
+      all[i] = i;
+    for (int offset = 0; offset < 256; offset += 64) {
+      host::clearTransmitted();
+      CHECK(ow.writeBytes(all + offset, 64));
+      const std::vector<uint32_t> block = transmitted();
+      host::clearTransmitted();
+      for (int i = offset; i < offset + 64; i++)
+        CHECK(ow.write(all[i]));
+      CHECK(block == transmitted());
+      host::clearTransmitted();
+      for (int i = offset; i < offset + 64; i++)
+        for (uint8_t b = 0; b < 8; b++)
+          CHECK(ow.write((all[i] >> b) & 0x01, 1));
+      CHECK(block == transmitted());
+    }
+  }
+  host::attach(PIN, nullptr);
+}
+
+int main() {
+  return runTests();
+}
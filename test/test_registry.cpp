@@ -0,0 +1,137 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) Mathieu Carbou
+ */
+#include "OneWireSimulator.h"
+#include "test.h"
+
+#include <MycilaDS18Registry.h>
+
+#include <vector>
+
+#define PIN 6
+
+static uint64_t addSensor(OneWireSimulator& sim, uint8_t family, uint64_t serial, int16_t raw, uint8_t resolution = 12) {
+  OneWireSimulator::Device device;
+  device.rom = OneWireSimulator::rom(family, serial);
+  device.temperature = raw;
+  device.resolution = resolution;
+  return sim.add(device);
+}
+
+struct Reading {
+    size_t index;
+    uint64_t address;
+    int16_t raw;
+    // getter called from the callback
+    float temperature;
+};
+
+TEST(discover_and_read) {
+  OneWireSimulator sim;
+  host::attach(PIN, &sim);
+  const uint64_t b20 = addSensor(sim, MYCILA_DS18_DS18B20, 1, 20 * 16);
+  const uint64_t s20 = addSensor(sim, MYCILA_DS18_DS18S20, 2, 30 * 16 + 8);
+  // not a DS18 sensor: skipped
+  addSensor(sim, 0x01, 3, 0);
+  {
+    OneWire32 oneWire(PIN);
+    Mycila::DS18Registry<4> registry;
+    registry.begin(&oneWire);
+    CHECK_EQ(registry.discover(), 2);
+    CHECK_EQ(registry.size(), 2);
+    CHECK(registry.getAddress(0) == b20);
+    CHECK(registry.getAddress(1) == s20);
+    // already registered
+    CHECK_EQ(registry.add(s20), 1);
+    CHECK(!registry.getRawTemperature(0).has_value());
+
+    struct Context {
+        Mycila::DS18Registry<4>& registry;
+        std::vector<Reading> readings;
+    } context{registry, {}};
+    std::vector<Reading>& readings = context.readings;
+    registry.listen(
+      [](size_t index, uint64_t address, int16_t raw, void* arg) {
+        Context* c = static_cast<Context*>(arg);
+        // the callback runs without the registry lock
+        c->readings.push_back({index, address, raw, c->registry.getTemperature(index).value_or(0)});
+      },
+      &context);
+
+    // broadcast conversion started by begin()
+    CHECK_EQ(registry.read(), 0);
+    host::advance(MYCILA_DS18_CONVERSION_TIME_MS);
+    CHECK_EQ(registry.read(), 2);
+    CHECK_EQ(readings.size(), 2);
+    if (readings.size() == 2) {
+      CHECK_EQ(readings[0].index, 0);
+      CHECK(readings[0].address == b20);
+      CHECK_EQ(readings[0].raw, 20 * 16);
+      CHECK(readings[0].temperature == 20.0f);
+      CHECK_EQ(readings[1].index, 1);
+      CHECK(readings[1].address == s20);
+      CHECK_EQ(readings[1].raw, 30 * 16 + 8);
+      CHECK(readings[1].temperature == 30.5f);
+    }
+    CHECK_EQ(registry.getResult(0), OneWire32::Result::OK);
+    CHECK_EQ(registry.getRawTemperature(1).value_or(0), 30 * 16 + 8);
+
+    // expiration
+    registry.setExpirationDelay(10);
+    host::advance(10000);
+    CHECK(!registry.getRawTemperature(0).has_value());
+
+    registry.listen(nullptr);
+  }
+  host::attach(PIN, nullptr);
+}
+
+TEST(conversion_time_of_the_slowest_sensor) {
+  OneWireSimulator sim;
+  host::attach(PIN, &sim);
+  addSensor(sim, MYCILA_DS18_DS18B20, 1, 20 * 16, 9);
+  addSensor(sim, MYCILA_DS18_DS18B20, 2, 21 * 16, 9);
+  {
+    OneWire32 oneWire(PIN);
+    Mycila::DS18Registry<4> registry;
+    registry.begin(&oneWire);
+    CHECK_EQ(registry.discover(), 2);
+    host::advance(MYCILA_DS18_CONVERSION_TIME_MS);
+    CHECK_EQ(registry.read(), 2);
+    // 9 bits: 94 ms
+    host::advance(94);
+    CHECK_EQ(registry.read(), 2);
+
+    // a DS18S20 always needs the full conversion time
+    const uint64_t s20 = addSensor(sim, MYCILA_DS18_DS18S20, 3, 25 * 16);
+    CHECK_EQ(registry.add(s20), 2);
+    host::advance(MYCILA_DS18_CONVERSION_TIME_MS);
+    CHECK_EQ(registry.read(), 3);
+    host::advance(94);
+    CHECK_EQ(registry.read(), 0);
+    host::advance(MYCILA_DS18_CONVERSION_TIME_MS - 94);
+    CHECK_EQ(registry.read(), 3);
+
+    CHECK(registry.remove(s20));
+    host::advance(MYCILA_DS18_CONVERSION_TIME_MS);
+    CHECK_EQ(registry.read(), 2);
+    host::advance(94);
+    CHECK_EQ(registry.read(), 2);
+  }
+  host::attach(PIN, nullptr);
+}
+
+TEST(full) {
+  Mycila::DS18Registry<2> registry;
+  CHECK_EQ(registry.add(1), 0);
+  CHECK_EQ(registry.add(2), 1);
+  CHECK_EQ(registry.add(3), -1);
+  CHECK(registry.remove(1));
+  CHECK_EQ(registry.add(3), 1);
+  CHECK(registry.getAddress(0) == 2);
+}
+
+int main() {
+  return runTests();
+}